@@ -1,16 +1,50 @@
 #version 450
 
+#extension GL_EXT_nonuniform_qualifier : require
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 fragNormal;
+layout(location = 3) flat in uint fragMaterial;
+layout(location = 4) flat in uint fragTexture;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 0) uniform sampler2D texSampler;
+// every texture, indexed per object
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+#define ALPHA_MODE_MASK 1
+#define ALPHA_MODE_BLEND 2
+
+// matches stMaterialDataGPU
+struct MaterialData
+{
+  vec4 baseColorFactor;
+  vec4 emissiveFactor; // w: alpha cutoff
+  vec4 factors; // metallic, roughness, normal scale, occlusion strength
+  uvec4 textures; // base color, metallic roughness, normal, occlusion
+  uvec4 flags; // emissive texture, alpha mode, double sided
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer MaterialBuffer
+{
+  MaterialData materials[];
+} materialBuffer;
 // layout(binding = 1) uniform sampler2D depthSampler;
 
 void main()
 {
-  outColor = vec4( fragColor * texture(texSampler, fragTexCoord).rgb , 1.0);
+  MaterialData material = materialBuffer.materials[fragMaterial];
+
+  vec4 baseColor = material.baseColorFactor * texture(textures[nonuniformEXT(fragTexture)], fragTexCoord) * vec4(fragColor, 1.0);
+
+  if (material.flags.y == ALPHA_MODE_MASK && baseColor.a < material.emissiveFactor.w)
+  {
+    discard;
+  }
+
+  float alpha = material.flags.y == ALPHA_MODE_BLEND ? baseColor.a : 1.0;
+
+  outColor = vec4(baseColor.rgb + material.emissiveFactor.rgb, alpha);
   // outColor = vec4(0.0, 0.0, gl_FragCoord.z * 5, 1.0);
 }
\ No newline at end of file
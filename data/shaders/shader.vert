@@ -3,6 +3,9 @@
 struct ObjectData
 {
 	mat4 model;
+	uint materialIndex;
+	uint textureIndex;
+	vec4 sphere;
 };
 
 layout( push_constant ) uniform constants
@@ -19,21 +22,32 @@ layout(location = 3) in vec2 inTexCoord;
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 layout(location = 2) out vec3 fragNormal;
+layout(location = 3) flat out uint fragMaterial;
+layout(location = 4) flat out uint fragTexture;
 
 layout(std140, set = 1, binding = 0) readonly buffer ObjectBuffer
 {
 	ObjectData objects[];
 } objectBuffer;
 
+layout(std430, set = 1, binding = 2) readonly buffer InstanceBuffer
+{
+	uint objects[];
+} instanceBuffer;
+
 const float AMBIENT = 0.02;
 
 void main()
 {
-  mat4 modelMatrix = objectBuffer.objects[gl_BaseInstance].model;
+  // firstInstance of the draw plus the instance, see CompactDraws
+  uint object = instanceBuffer.objects[gl_InstanceIndex];
+  mat4 modelMatrix = objectBuffer.objects[object].model;
 
   gl_Position = PushConstants.viewProj * modelMatrix * vec4(inPosition, 1.0);
   fragTexCoord = inTexCoord;
   fragNormal = inNormal;
+  fragMaterial = objectBuffer.objects[object].materialIndex;
+  fragTexture = objectBuffer.objects[object].textureIndex;
   // fragDirLight = PushConstants.dirLight;
 
   // mat3 normalMatrix = transpose(inverse(mat3(PushConstants.model)));
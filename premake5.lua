@@ -16,7 +16,7 @@ project "resources"
         prebuildcommands { 'pushd ".bin/%{cfg.buildcfg}" && IF NOT EXIST data mklink /j "data" "../../data" && popd' }
         prebuildmessage "Create folder link..."
 
-    filter { 'files:**.frag or files:**.vert' }
+    filter { 'files:**.frag or files:**.vert or files:**.comp' }
         buildmessage 'Compiling %{wks.location}%{file.relpath}'
         buildcommands '"$(VULKAN_SDK)/Bin/glslangValidator.exe" -V "%{wks.location}%{file.relpath}" -o "%{file.directory}%{file.name}.spv"'
         buildoutputs "%{file.directory}%{file.name}.spv"
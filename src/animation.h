@@ -0,0 +1,971 @@
+
+// ############################################################################
+// # skeletons and clips
+// ############################################################################
+
+struct
+stJointPose
+{
+  glm::vec3 Translation = { 0.0f, 0.0f, 0.0f };
+  glm::quat Rotation = { 1.0f, 0.0f, 0.0f, 0.0f };
+  glm::vec3 Scale = { 1.0f, 1.0f, 1.0f };
+};
+
+// one glTF skin; Order lists joints parents first
+struct
+stSkeleton
+{
+  std::vector<int32_t> Parents;
+  std::vector<uint32_t> Order;
+  std::vector<stJointPose> BindPose;
+  std::vector<glm::mat4> InverseBindMatrices;
+  std::vector<glm::mat4> RootTransforms; // nodes above a root joint, identity otherwise
+};
+
+enum
+enAnimationPath
+{
+  ANIMATION_PATH_TRANSLATION = 0,
+  ANIMATION_PATH_ROTATION = 1,
+  ANIMATION_PATH_SCALE = 2
+};
+
+enum
+enAnimationInterpolation
+{
+  ANIMATION_INTERPOLATION_LINEAR = 0,
+  ANIMATION_INTERPOLATION_STEP = 1,
+  ANIMATION_INTERPOLATION_CUBIC = 2
+};
+
+// cubic spline channels store in-tangent, value, out-tangent per key
+struct
+stAnimationChannel
+{
+  uint32_t Joint = 0;
+  enAnimationPath Path = ANIMATION_PATH_TRANSLATION;
+  enAnimationInterpolation Interpolation = ANIMATION_INTERPOLATION_LINEAR;
+  std::vector<float> Times;
+  std::vector<glm::vec4> Values;
+};
+
+typedef stHandle<stSkeleton> stSkeletonHandle;
+
+// Value = Min + Extent * quantized / 65535, rotations are (x, y, z, w)
+struct
+stCompressedTrack
+{
+  uint16_t Joint = 0;
+  uint8_t Path = ANIMATION_PATH_TRANSLATION;
+  uint8_t Stepped = 0;
+  glm::vec4 Min = glm::vec4(0.0f);
+  glm::vec4 Extent = glm::vec4(0.0f);
+};
+
+struct
+stCompressedKey
+{
+  uint16_t Time = 0; // in units of stCompressedClip::TimeScale
+  uint16_t Track = 0;
+  uint16_t Value[4] = {};
+};
+
+// Linear keys left after key reduction, quantized to 16 bits. Keys holds the
+// first key of every track in track order, then the remaining keys sorted by
+// the time they are needed (the time of the previous key in their track),
+// so playback reads the stream front to back. Tracks are ordered rotations
+// first, the sampler works on them as SoA lanes.
+struct
+stCompressedClip
+{
+  float TimeScale = 0.0f;
+  uint32_t RotationCount = 0;
+  uint32_t LaneCount = 0; // track count padded to a multiple of 4
+  std::vector<stCompressedTrack> Tracks;
+  std::vector<float> StepMask; // per lane, 1 for step interpolation
+  std::vector<stCompressedKey> Keys;
+};
+
+// raw channels are dropped once the clip is compressed
+struct
+stAnimationClip
+{
+  std::string Name;
+  float Duration = 0.0f;
+  stSkeletonHandle Skeleton;
+  std::vector<stAnimationChannel> Channels;
+  stCompressedClip Compressed;
+};
+
+typedef stHandle<stAnimationClip> stClipHandle;
+
+// playback position in a compressed clip, the two keys around the current
+// time of every track decoded into SoA lanes
+struct
+stClipCursor
+{
+  stClipHandle Clip;
+  uint32_t Key = 0;
+  float Time = 0.0f;
+  std::vector<float> T0;
+  std::vector<float> T1;
+  std::vector<float> V0[4];
+  std::vector<float> V1[4];
+};
+
+namespace anim
+{
+
+stResourceTable<stSkeleton, 64> Skeletons;
+stResourceTable<stAnimationClip, 64> Clips;
+std::unordered_map<std::string, stClipHandle> CachedClips; // "<asset>#<clip name>"
+
+glm::mat4
+read_node_matrix(
+  const cgltf_node* node)
+{
+  cgltf_float matrix[16];
+  cgltf_node_transform_local(node, matrix);
+
+  glm::mat4 result;
+  memcpy(&result[0][0], matrix, sizeof(matrix));
+  return result;
+}
+
+stSkeletonHandle
+load_gltf_skeleton(
+  const cgltf_skin& skin,
+  std::unordered_map<const cgltf_node*, uint32_t>& jointIndices)
+{
+  stSkeletonHandle handle = Skeletons.Create();
+  stSkeleton* skeleton = Skeletons.Get(handle);
+
+  size_t jointCount = skin.joints_count;
+
+  for (size_t j = 0; j < jointCount; j++)
+  {
+    jointIndices[skin.joints[j]] = (uint32_t)j;
+  }
+
+  skeleton->Parents.assign(jointCount, -1);
+  skeleton->BindPose.resize(jointCount);
+  skeleton->InverseBindMatrices.assign(jointCount, glm::mat4(1.0f));
+  skeleton->RootTransforms.assign(jointCount, glm::mat4(1.0f));
+
+  if (skin.inverse_bind_matrices)
+  {
+    std::vector<cgltf_float> matrices(skin.inverse_bind_matrices->count * 16);
+    cgltf_accessor_unpack_floats(skin.inverse_bind_matrices, matrices.data(), matrices.size());
+
+    for (size_t j = 0; j < jointCount && j < skin.inverse_bind_matrices->count; j++)
+    {
+      memcpy(&skeleton->InverseBindMatrices[j][0][0], &matrices[j * 16], sizeof(glm::mat4));
+    }
+  }
+
+  for (size_t j = 0; j < jointCount; j++)
+  {
+    const cgltf_node* node = skin.joints[j];
+    stJointPose& pose = skeleton->BindPose[j];
+
+    if (node->has_translation)
+      pose.Translation = glm::vec3(node->translation[0], node->translation[1], node->translation[2]);
+    if (node->has_rotation)
+      pose.Rotation = glm::quat(node->rotation[3], node->rotation[0], node->rotation[1], node->rotation[2]);
+    if (node->has_scale)
+      pose.Scale = glm::vec3(node->scale[0], node->scale[1], node->scale[2]);
+
+    if (node->has_matrix)
+    {
+      glm::mat4 matrix = read_node_matrix(node);
+      pose.Translation = glm::vec3(matrix[3]);
+      pose.Scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+      pose.Rotation = glm::quat_cast(glm::mat3(glm::vec3(matrix[0]) / pose.Scale.x, glm::vec3(matrix[1]) / pose.Scale.y, glm::vec3(matrix[2]) / pose.Scale.z));
+    }
+
+    auto parent = node->parent ? jointIndices.find(node->parent) : jointIndices.end();
+    if (parent != jointIndices.end())
+    {
+      skeleton->Parents[j] = (int32_t)parent->second;
+    }
+    else
+    {
+      glm::mat4 above = glm::mat4(1.0f);
+      for (const cgltf_node* ancestor = node->parent; ancestor; ancestor = ancestor->parent)
+      {
+        above = read_node_matrix(ancestor) * above;
+      }
+      skeleton->RootTransforms[j] = above;
+    }
+  }
+
+  // parents first, so world matrices resolve in one pass
+  std::vector<uint32_t> depths(jointCount, 0);
+  for (size_t j = 0; j < jointCount; j++)
+  {
+    for (int32_t p = skeleton->Parents[j]; p >= 0 && depths[j] < jointCount; p = skeleton->Parents[p])
+    {
+      depths[j]++;
+    }
+    skeleton->Order.push_back((uint32_t)j);
+  }
+
+  std::stable_sort(skeleton->Order.begin(), skeleton->Order.end(),
+    [&depths](uint32_t a, uint32_t b)
+    {
+      return depths[a] < depths[b];
+    });
+
+  return handle;
+}
+
+glm::vec4
+sample_channel(
+  const stAnimationChannel& channel,
+  float time);
+
+void
+compress_clip(
+  stAnimationClip& clip);
+
+void
+load_gltf_clips(
+  const cgltf_data* data,
+  const char* path,
+  const std::vector<stSkeletonHandle>& skeletons,
+  const std::vector<std::unordered_map<const cgltf_node*, uint32_t>>& jointIndices)
+{
+  for (size_t ai = 0; ai < data->animations_count; ++ai)
+  {
+    const cgltf_animation& animation = data->animations[ai];
+
+    // a clip drives the first skin that owns one of its target nodes
+    int32_t skin = -1;
+    for (size_t ci = 0; ci < animation.channels_count && skin < 0; ++ci)
+    {
+      for (size_t si = 0; si < jointIndices.size(); ++si)
+      {
+        if (jointIndices[si].count(animation.channels[ci].target_node))
+        {
+          skin = (int32_t)si;
+          break;
+        }
+      }
+    }
+
+    if (skin < 0)
+    {
+      fprintf(stderr, "Warning: ignoring animation %d, it does not target any skin\n", int(ai));
+      continue;
+    }
+
+    stClipHandle handle = Clips.Create();
+    stAnimationClip* clip = Clips.Get(handle);
+    clip->Name = animation.name ? animation.name : std::to_string(ai);
+    clip->Skeleton = skeletons[skin];
+
+    for (size_t ci = 0; ci < animation.channels_count; ++ci)
+    {
+      const cgltf_animation_channel& source = animation.channels[ci];
+
+      auto joint = jointIndices[skin].find(source.target_node);
+      if (joint == jointIndices[skin].end() || source.target_path == cgltf_animation_path_type_weights)
+      {
+        continue;
+      }
+
+      stAnimationChannel channel;
+      channel.Joint = joint->second;
+      channel.Path = source.target_path == cgltf_animation_path_type_rotation ? ANIMATION_PATH_ROTATION
+        : source.target_path == cgltf_animation_path_type_scale ? ANIMATION_PATH_SCALE
+        : ANIMATION_PATH_TRANSLATION;
+      channel.Interpolation = source.sampler->interpolation == cgltf_interpolation_type_step ? ANIMATION_INTERPOLATION_STEP
+        : source.sampler->interpolation == cgltf_interpolation_type_cubic_spline ? ANIMATION_INTERPOLATION_CUBIC
+        : ANIMATION_INTERPOLATION_LINEAR;
+
+      const cgltf_accessor* input = source.sampler->input;
+      const cgltf_accessor* output = source.sampler->output;
+
+      channel.Times.resize(input->count);
+      cgltf_accessor_unpack_floats(input, channel.Times.data(), channel.Times.size());
+
+      size_t components = channel.Path == ANIMATION_PATH_ROTATION ? 4 : 3;
+      std::vector<cgltf_float> values(output->count * components);
+      cgltf_accessor_unpack_floats(output, values.data(), values.size());
+
+      channel.Values.resize(output->count);
+      for (size_t v = 0; v < output->count; v++)
+      {
+        channel.Values[v] = glm::vec4(
+          values[v * components + 0],
+          values[v * components + 1],
+          values[v * components + 2],
+          components == 4 ? values[v * components + 3] : 0.0f);
+      }
+
+      if (!channel.Times.empty())
+      {
+        clip->Duration = glm::max(clip->Duration, channel.Times.back());
+      }
+
+      clip->Channels.push_back(std::move(channel));
+    }
+
+#if ANIMATION_COMPRESSION
+    compress_clip(*clip);
+#endif
+
+    CachedClips[std::string(path) + "#" + clip->Name] = handle;
+  }
+}
+
+stClipHandle
+get_clip(
+  const char* name)
+{
+  auto it = CachedClips.find(name);
+  return it != CachedClips.end() ? it->second : stClipHandle{};
+}
+
+// first clip loaded for the skeleton, if any
+stClipHandle
+find_clip(
+  stSkeletonHandle skeleton)
+{
+  for (uint32_t i = 0; i < Clips.Capacity(); i++)
+  {
+    if (Clips.IsAlive(i) && Clips.Slot(i).Skeleton == skeleton)
+    {
+      return Clips.HandleOf(i);
+    }
+  }
+  return stClipHandle{};
+}
+
+glm::vec4
+sample_channel(
+  const stAnimationChannel& channel,
+  float time)
+{
+  size_t keyCount = channel.Times.size();
+  bool cubic = channel.Interpolation == ANIMATION_INTERPOLATION_CUBIC;
+  auto value = [&](size_t key) { return channel.Values[cubic ? key * 3 + 1 : key]; };
+
+  if (keyCount == 0)
+  {
+    return glm::vec4(0.0f);
+  }
+
+  if (keyCount == 1 || time <= channel.Times[0])
+  {
+    return value(0);
+  }
+
+  if (time >= channel.Times[keyCount - 1])
+  {
+    return value(keyCount - 1);
+  }
+
+  size_t next = std::upper_bound(channel.Times.begin(), channel.Times.end(), time) - channel.Times.begin();
+  size_t prev = next - 1;
+
+  float dt = channel.Times[next] - channel.Times[prev];
+  float t = dt > 0.0f ? (time - channel.Times[prev]) / dt : 0.0f;
+
+  switch (channel.Interpolation)
+  {
+    case ANIMATION_INTERPOLATION_STEP:
+      return value(prev);
+
+    case ANIMATION_INTERPOLATION_CUBIC:
+    {
+      float t2 = t * t;
+      float t3 = t2 * t;
+
+      glm::vec4 p0 = channel.Values[prev * 3 + 1];
+      glm::vec4 m0 = channel.Values[prev * 3 + 2] * dt;
+      glm::vec4 p1 = channel.Values[next * 3 + 1];
+      glm::vec4 m1 = channel.Values[next * 3 + 0] * dt;
+
+      glm::vec4 result = (2.0f * t3 - 3.0f * t2 + 1.0f) * p0 + (t3 - 2.0f * t2 + t) * m0
+        + (-2.0f * t3 + 3.0f * t2) * p1 + (t3 - t2) * m1;
+
+      if (channel.Path == ANIMATION_PATH_ROTATION)
+      {
+        result = glm::normalize(result);
+      }
+      return result;
+    }
+
+    default:
+    {
+      if (channel.Path == ANIMATION_PATH_ROTATION)
+      {
+        glm::vec4 a = value(prev);
+        glm::vec4 b = value(next);
+        glm::quat q = glm::slerp(glm::quat(a.w, a.x, a.y, a.z), glm::quat(b.w, b.x, b.y, b.z), t);
+        return glm::vec4(q.x, q.y, q.z, q.w);
+      }
+      return glm::mix(value(prev), value(next), t);
+    }
+  }
+}
+
+// ############################################################################
+// # compressed clips
+// ############################################################################
+
+// indices of the keys that linear interpolation can not rebuild within
+// ANIMATION_KEY_ERROR, the first and last key of a changing track stay
+std::vector<uint32_t>
+reduce_keys(
+  const std::vector<float>& times,
+  const std::vector<glm::vec4>& values,
+  bool rotation,
+  bool stepped)
+{
+  std::vector<uint32_t> kept;
+  uint32_t count = (uint32_t)times.size();
+
+  if (count == 0)
+  {
+    return kept;
+  }
+
+  kept.push_back(0);
+
+  uint32_t anchor = 0;
+  for (uint32_t next = 1; next + 1 < count; next++)
+  {
+    bool removable = true;
+
+    if (stepped)
+    {
+      removable = glm::length(values[next] - values[anchor]) <= ANIMATION_KEY_ERROR;
+    }
+    else
+    {
+      // can anchor -> next + 1 rebuild every key in between?
+      float dt = times[next + 1] - times[anchor];
+
+      for (uint32_t k = anchor + 1; k <= next && removable; k++)
+      {
+        float t = dt > 0.0f ? (times[k] - times[anchor]) / dt : 0.0f;
+
+        glm::vec4 value = glm::mix(values[anchor], values[next + 1], t);
+        if (rotation)
+        {
+          value = glm::normalize(value);
+        }
+
+        removable = glm::length(value - values[k]) <= ANIMATION_KEY_ERROR;
+      }
+    }
+
+    if (!removable)
+    {
+      kept.push_back(next);
+      anchor = next;
+    }
+  }
+
+  // a constant track keeps its first key only
+  if (count > 1 && (kept.size() > 1 || glm::length(values[count - 1] - values[anchor]) > ANIMATION_KEY_ERROR))
+  {
+    kept.push_back(count - 1);
+  }
+
+  return kept;
+}
+
+void
+compress_clip(
+  stAnimationClip& clip)
+{
+  struct stDenseTrack
+  {
+    stCompressedTrack Track;
+    std::vector<float> Times;
+    std::vector<glm::vec4> Values;
+  };
+
+  std::vector<stDenseTrack> dense;
+
+  for (const stAnimationChannel& channel : clip.Channels)
+  {
+    if (channel.Times.empty())
+    {
+      continue;
+    }
+
+    stDenseTrack track;
+    track.Track.Joint = (uint16_t)channel.Joint;
+    track.Track.Path = (uint8_t)channel.Path;
+    track.Track.Stepped = channel.Interpolation == ANIMATION_INTERPOLATION_STEP;
+
+    // cubic splines become linear keys at a fixed rate
+    if (channel.Interpolation == ANIMATION_INTERPOLATION_CUBIC)
+    {
+      float start = channel.Times.front();
+      float end = channel.Times.back();
+      uint32_t steps = (uint32_t)glm::ceil((end - start) * ANIMATION_RESAMPLE_RATE);
+
+      for (uint32_t i = 0; i <= steps; i++)
+      {
+        track.Times.push_back(steps > 0 ? glm::mix(start, end, (float)i / steps) : start);
+      }
+    }
+    else
+    {
+      track.Times = channel.Times;
+    }
+
+    for (float time : track.Times)
+    {
+      track.Values.push_back(sample_channel(channel, time));
+    }
+
+    // neighbouring rotations in one hemisphere, so the sampler can nlerp
+    if (channel.Path == ANIMATION_PATH_ROTATION)
+    {
+      for (size_t i = 1; i < track.Values.size(); i++)
+      {
+        if (glm::dot(track.Values[i], track.Values[i - 1]) < 0.0f)
+        {
+          track.Values[i] = -track.Values[i];
+        }
+      }
+    }
+
+    std::vector<uint32_t> kept = reduce_keys(track.Times, track.Values, channel.Path == ANIMATION_PATH_ROTATION, track.Track.Stepped);
+
+    std::vector<float> times;
+    std::vector<glm::vec4> values;
+    for (uint32_t k : kept)
+    {
+      times.push_back(track.Times[k]);
+      values.push_back(track.Values[k]);
+    }
+
+    glm::vec4 low = values[0];
+    glm::vec4 high = values[0];
+    for (const glm::vec4& value : values)
+    {
+      low = glm::min(low, value);
+      high = glm::max(high, value);
+    }
+
+    track.Track.Min = low;
+    track.Track.Extent = high - low;
+    track.Times = std::move(times);
+    track.Values = std::move(values);
+
+    dense.push_back(std::move(track));
+  }
+
+  std::stable_sort(dense.begin(), dense.end(), [](const stDenseTrack& a, const stDenseTrack& b)
+  {
+    return (a.Track.Path == ANIMATION_PATH_ROTATION) > (b.Track.Path == ANIMATION_PATH_ROTATION);
+  });
+
+  stCompressedClip& compressed = clip.Compressed;
+  compressed = {};
+  compressed.TimeScale = clip.Duration / 65535.0f;
+  compressed.LaneCount = ((uint32_t)dense.size() + 3) & ~3u;
+  compressed.StepMask.assign(compressed.LaneCount, 0.0f);
+
+  auto encode = [&](uint32_t track, uint32_t key)
+  {
+    const stDenseTrack& source = dense[track];
+
+    stCompressedKey result;
+    result.Track = (uint16_t)track;
+    result.Time = compressed.TimeScale > 0.0f
+      ? (uint16_t)glm::clamp(glm::round(source.Times[key] / compressed.TimeScale), 0.0f, 65535.0f)
+      : 0;
+
+    for (int c = 0; c < 4; c++)
+    {
+      float extent = source.Track.Extent[c];
+      float unorm = extent > 0.0f ? (source.Values[key][c] - source.Track.Min[c]) / extent : 0.0f;
+      result.Value[c] = (uint16_t)glm::round(glm::clamp(unorm, 0.0f, 1.0f) * 65535.0f);
+    }
+    return result;
+  };
+
+  for (uint32_t i = 0; i < dense.size(); i++)
+  {
+    compressed.Tracks.push_back(dense[i].Track);
+    compressed.StepMask[i] = dense[i].Track.Stepped ? 1.0f : 0.0f;
+    compressed.RotationCount += dense[i].Track.Path == ANIMATION_PATH_ROTATION;
+    compressed.Keys.push_back(encode(i, 0));
+  }
+
+  // key k of a track is needed once playback reaches key k - 1
+  struct stStreamKey
+  {
+    stCompressedKey Key;
+    uint16_t Needed;
+    uint32_t Index;
+  };
+
+  std::vector<stStreamKey> stream;
+  for (uint32_t i = 0; i < dense.size(); i++)
+  {
+    for (uint32_t k = 1; k < dense[i].Times.size(); k++)
+    {
+      stream.push_back({ encode(i, k), encode(i, k - 1).Time, k });
+    }
+  }
+
+  std::sort(stream.begin(), stream.end(), [](const stStreamKey& a, const stStreamKey& b)
+  {
+    if (a.Needed != b.Needed) return a.Needed < b.Needed;
+    if (a.Key.Track != b.Key.Track) return a.Key.Track < b.Key.Track;
+    return a.Index < b.Index;
+  });
+
+  for (const stStreamKey& key : stream)
+  {
+    compressed.Keys.push_back(key.Key);
+  }
+
+  clip.Channels.clear();
+  clip.Channels.shrink_to_fit();
+}
+
+inline void
+consume_key(
+  stClipCursor& cursor,
+  const stCompressedClip& compressed,
+  const stCompressedKey& key)
+{
+  uint32_t lane = key.Track;
+  const stCompressedTrack& track = compressed.Tracks[lane];
+
+  cursor.T0[lane] = cursor.T1[lane];
+  cursor.T1[lane] = key.Time * compressed.TimeScale;
+
+  for (int c = 0; c < 4; c++)
+  {
+    cursor.V0[c][lane] = cursor.V1[c][lane];
+    cursor.V1[c][lane] = track.Min[c] + track.Extent[c] * (key.Value[c] * (1.0f / 65535.0f));
+  }
+}
+
+void
+reset_cursor(
+  stClipCursor& cursor,
+  stClipHandle clip,
+  const stCompressedClip& compressed)
+{
+  cursor.Clip = clip;
+  cursor.Time = 0.0f;
+  cursor.T0.assign(compressed.LaneCount, 0.0f);
+  cursor.T1.assign(compressed.LaneCount, 0.0f);
+  for (int c = 0; c < 4; c++)
+  {
+    cursor.V0[c].assign(compressed.LaneCount, 0.0f);
+    cursor.V1[c].assign(compressed.LaneCount, 0.0f);
+  }
+
+  // the first key holds the track until its second key is reached
+  uint32_t trackCount = (uint32_t)compressed.Tracks.size();
+  for (uint32_t i = 0; i < trackCount; i++)
+  {
+    consume_key(cursor, compressed, compressed.Keys[i]);
+    consume_key(cursor, compressed, compressed.Keys[i]);
+  }
+  cursor.Key = trackCount;
+}
+
+// writes every lane as SoA, out[c * LaneCount + lane]; seeking backwards
+// replays the stream from the start
+void
+sample_compressed(
+  stClipCursor& cursor,
+  const stCompressedClip& compressed,
+  float time,
+  float* out)
+{
+  if (time < cursor.Time)
+  {
+    reset_cursor(cursor, cursor.Clip, compressed);
+  }
+
+  // a key is due once time passes the end of its track's current window
+  while (cursor.Key < compressed.Keys.size())
+  {
+    const stCompressedKey& key = compressed.Keys[cursor.Key];
+    if (cursor.T1[key.Track] > time)
+    {
+      break;
+    }
+
+    consume_key(cursor, compressed, key);
+    cursor.Key++;
+  }
+  cursor.Time = time;
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 epsilon = _mm_set1_ps(1e-6f);
+  const __m128 now = _mm_set1_ps(time);
+  const __m128 rotationCount = _mm_set1_ps((float)compressed.RotationCount);
+
+  uint32_t lanes = compressed.LaneCount;
+
+  for (uint32_t lane = 0; lane < lanes; lane += 4)
+  {
+    __m128 t0 = _mm_loadu_ps(&cursor.T0[lane]);
+    __m128 t1 = _mm_loadu_ps(&cursor.T1[lane]);
+
+    __m128 t = _mm_div_ps(_mm_sub_ps(now, t0), _mm_max_ps(_mm_sub_ps(t1, t0), epsilon));
+    t = _mm_min_ps(_mm_max_ps(t, zero), one);
+
+    // step lanes jump to the next key only at its time
+    __m128 step = _mm_loadu_ps(&compressed.StepMask[lane]);
+    __m128 stepT = _mm_and_ps(_mm_cmpge_ps(t, one), one);
+    t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(stepT, t), step));
+
+    __m128 v[4];
+    for (int c = 0; c < 4; c++)
+    {
+      __m128 v0 = _mm_loadu_ps(&cursor.V0[c][lane]);
+      __m128 v1 = _mm_loadu_ps(&cursor.V1[c][lane]);
+      v[c] = _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t));
+    }
+
+    // nlerp, renormalize the rotation lanes only
+    __m128 index = _mm_set_ps((float)lane + 3, (float)lane + 2, (float)lane + 1, (float)lane);
+    __m128 isRotation = _mm_cmplt_ps(index, rotationCount);
+
+    __m128 lengthSq = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(v[0], v[0]), _mm_mul_ps(v[1], v[1])),
+      _mm_add_ps(_mm_mul_ps(v[2], v[2]), _mm_mul_ps(v[3], v[3])));
+    __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(lengthSq, epsilon)));
+
+    for (int c = 0; c < 4; c++)
+    {
+      __m128 normalized = _mm_mul_ps(v[c], inverseLength);
+      v[c] = _mm_or_ps(_mm_and_ps(isRotation, normalized), _mm_andnot_ps(isRotation, v[c]));
+      _mm_storeu_ps(&out[c * lanes + lane], v[c]);
+    }
+  }
+}
+
+}
+
+// ############################################################################
+// # animation system
+// ############################################################################
+
+#define ANIMATOR_NONE UINT32_MAX // no joint matrices left, see MAX_SKINNING_JOINTS
+
+struct
+stAnimator
+{
+  stSkeletonHandle Skeleton;
+  stClipHandle Clip;
+  float Time = 0.0f;
+  float Speed = 1.0f;
+  bool Loop = true;
+  uint32_t JointOffset = 0; // first matrix in stAnimationSystem::JointMatrices
+  stClipCursor Cursor;
+
+  // scratch of Sample, keeps its capacity between frames
+  std::vector<stJointPose> Pose;
+  std::vector<float> Values;
+  std::vector<glm::mat4> World;
+};
+
+// Animators own a contiguous range of JointMatrices, so Update samples them
+// on the job system without any locking. Each matrix is the joint's world
+// transform times its inverse bind matrix, ready for skinning. The skinning
+// pass uploads all of them each frame, so they never exceed
+// MAX_SKINNING_JOINTS.
+struct
+stAnimationSystem
+{
+  // ANIMATOR_NONE when the skeleton's joints do not fit anymore
+  uint32_t
+  CreateAnimator(
+    stSkeletonHandle skeleton,
+    stClipHandle clip)
+  {
+    stSkeleton* source = anim::Skeletons.Get(skeleton);
+    size_t jointCount = source ? source->Parents.size() : 0;
+
+    if (JointMatrices.size() + jointCount > MAX_SKINNING_JOINTS)
+    {
+      fprintf(stderr, "Warning: %zu joints exceed MAX_SKINNING_JOINTS, the mesh stays in bind pose\n", JointMatrices.size() + jointCount);
+      return ANIMATOR_NONE;
+    }
+
+    stAnimator animator = {};
+    animator.Skeleton = skeleton;
+    animator.Clip = clip;
+    animator.JointOffset = (uint32_t)JointMatrices.size();
+
+    JointMatrices.resize(JointMatrices.size() + jointCount, glm::mat4(1.0f));
+
+    Animators.push_back(animator);
+    return (uint32_t)Animators.size() - 1;
+  }
+
+  // one shared animator per skeleton playing its first clip
+  uint32_t
+  FindOrCreateAnimator(
+    stSkeletonHandle skeleton)
+  {
+    auto it = DefaultAnimators.find(skeleton.Index);
+    if (it != DefaultAnimators.end() && Animators[it->second].Skeleton == skeleton)
+    {
+      return it->second;
+    }
+
+    uint32_t animator = CreateAnimator(skeleton, anim::find_clip(skeleton));
+    if (animator != ANIMATOR_NONE)
+    {
+      DefaultAnimators[skeleton.Index] = animator;
+    }
+    return animator;
+  }
+
+  void
+  Play(
+    uint32_t animator,
+    stClipHandle clip,
+    bool loop = true)
+  {
+    Animators[animator].Clip = clip;
+    Animators[animator].Time = 0.0f;
+    Animators[animator].Loop = loop;
+  }
+
+  void
+  Update(
+    float delta,
+    stJobSystem* jobs)
+  {
+    for (stAnimator& animator : Animators)
+    {
+      stAnimationClip* clip = anim::Clips.Get(animator.Clip);
+      float duration = clip ? clip->Duration : 0.0f;
+
+      animator.Time += delta * animator.Speed;
+
+      if (duration > 0.0f)
+      {
+        animator.Time = animator.Loop
+          ? fmodf(fmodf(animator.Time, duration) + duration, duration)
+          : glm::clamp(animator.Time, 0.0f, duration);
+      }
+    }
+
+    uint32_t count = (uint32_t)Animators.size();
+    uint32_t chunkCount = (count + ANIMATION_CHUNK - 1) / ANIMATION_CHUNK;
+
+    auto sample = [this, count](uint32_t chunk)
+    {
+      uint32_t end = glm::min(count, (chunk + 1) * ANIMATION_CHUNK);
+      for (uint32_t i = chunk * ANIMATION_CHUNK; i < end; i++)
+      {
+        Sample(Animators[i]);
+      }
+    };
+
+    if (jobs)
+    {
+      jobs->ParallelFor(chunkCount, sample);
+    }
+    else
+    {
+      for (uint32_t i = 0; i < chunkCount; i++)
+      {
+        sample(i);
+      }
+    }
+  }
+
+  void
+  Sample(
+    stAnimator& animator)
+  {
+    const stSkeleton* skeleton = anim::Skeletons.Get(animator.Skeleton);
+    if (!skeleton)
+    {
+      return;
+    }
+
+    std::vector<stJointPose>& pose = animator.Pose;
+    pose.assign(skeleton->BindPose.begin(), skeleton->BindPose.end());
+
+    const stAnimationClip* clip = anim::Clips.Get(animator.Clip);
+
+    if (clip && !clip->Compressed.Keys.empty())
+    {
+      const stCompressedClip& compressed = clip->Compressed;
+
+      if (animator.Cursor.Clip != animator.Clip)
+      {
+        anim::reset_cursor(animator.Cursor, animator.Clip, compressed);
+      }
+
+      std::vector<float>& values = animator.Values;
+      values.resize(compressed.LaneCount * 4);
+      anim::sample_compressed(animator.Cursor, compressed, animator.Time, values.data());
+
+      uint32_t lanes = compressed.LaneCount;
+      for (uint32_t i = 0; i < compressed.Tracks.size(); i++)
+      {
+        const stCompressedTrack& track = compressed.Tracks[i];
+        glm::vec4 value = glm::vec4(values[i], values[lanes + i], values[lanes * 2 + i], values[lanes * 3 + i]);
+        stJointPose& joint = pose[track.Joint];
+
+        switch (track.Path)
+        {
+          case ANIMATION_PATH_TRANSLATION: joint.Translation = glm::vec3(value); break;
+          case ANIMATION_PATH_ROTATION: joint.Rotation = glm::quat(value.w, value.x, value.y, value.z); break;
+          case ANIMATION_PATH_SCALE: joint.Scale = glm::vec3(value); break;
+        }
+      }
+    }
+    else if (clip)
+    {
+      for (const stAnimationChannel& channel : clip->Channels)
+      {
+        glm::vec4 value = anim::sample_channel(channel, animator.Time);
+        stJointPose& joint = pose[channel.Joint];
+
+        switch (channel.Path)
+        {
+          case ANIMATION_PATH_TRANSLATION: joint.Translation = glm::vec3(value); break;
+          case ANIMATION_PATH_ROTATION: joint.Rotation = glm::normalize(glm::quat(value.w, value.x, value.y, value.z)); break;
+          case ANIMATION_PATH_SCALE: joint.Scale = glm::vec3(value); break;
+        }
+      }
+    }
+
+    std::vector<glm::mat4>& world = animator.World;
+    world.resize(pose.size());
+
+    for (uint32_t j : skeleton->Order)
+    {
+      const stJointPose& joint = pose[j];
+
+      glm::mat4 local = glm::translate(glm::mat4(1.0f), joint.Translation)
+        * glm::mat4_cast(joint.Rotation)
+        * glm::scale(glm::mat4(1.0f), joint.Scale);
+
+      int32_t parent = skeleton->Parents[j];
+      world[j] = parent >= 0 ? world[parent] * local : skeleton->RootTransforms[j] * local;
+
+      JointMatrices[animator.JointOffset + j] = world[j] * skeleton->InverseBindMatrices[j];
+    }
+  }
+
+  std::vector<stAnimator> Animators;
+  std::vector<glm::mat4> JointMatrices;
+  std::unordered_map<uint32_t, uint32_t> DefaultAnimators; // skeleton slot -> animator
+};
@@ -12,6 +12,8 @@ stCamera
   float Pitch = 0.0f;
   float Yaw = 0.0f;
 
+  float FieldOfView = 75.0f;
+
   // bool Sprint = false;
   bool Locked = false;
 
@@ -78,13 +80,13 @@ stCamera::get_projection_matrix(const glm::vec2& wondowSize, bool reverse)
 {
   if (reverse)
 	{
-		glm::mat4 pro = glm::perspective(glm::radians(75.f), wondowSize.x / (float) wondowSize.y, 5000.0f, 0.1f);
+		glm::mat4 pro = glm::perspective(glm::radians(FieldOfView), wondowSize.x / (float) wondowSize.y, 5000.0f, 0.1f);
 		pro[1][1] *= -1;
 		return pro;
 	}
 	else
   {
-		glm::mat4 pro = glm::perspective(glm::radians(75.f), wondowSize.x / (float) wondowSize.y, 0.1f, 5000.0f);
+		glm::mat4 pro = glm::perspective(glm::radians(FieldOfView), wondowSize.x / (float) wondowSize.y, 0.1f, 5000.0f);
 		pro[1][1] *= -1;
 		return pro;
 	}
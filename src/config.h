@@ -19,14 +19,54 @@
 
 #define VK_USE_PLATFORM_WIN32_KHR
 
-#define MAX_ENTITY_MESH_COUNT 1024
-#define MAX_TEXTURE_COUNT 1024
-#define MAX_MESH_COUNT 4096
-
 #define SHADOWMAP_DIM 1024
 
-// TODO: need to be bynamic
-#define MAX_OBJECTS_COUNT 1024
+#define MAX_TEXTURE_MIPS 16
+
+#define MEMORY_BLOCK_SIZE (64ull * 1024 * 1024) // bytes per VkDeviceMemory block, larger resources get their own
+#define MEMORY_STAGING_BLOCK_SIZE (16ull * 1024 * 1024)
+#define TRANSFER_QUEUE 1 // uploads run on a transfer-only queue family when the device has one
+#define UPLOAD_RING_SIZE (32ull * 1024 * 1024) // staging ring of the upload batches, larger copies get their own buffer
+
+#define GEOMETRY_ARENA_VERTICES (1024 * 1024) // initial capacity, the arena doubles when full
+#define GEOMETRY_ARENA_INDICES (4 * 1024 * 1024)
+
+#define MESH_CACHE 1
+#define MESH_CACHE_ENCODE 1
+
+#define MAX_MORPH_ACTIVE_TARGETS 8
+#define MORPH_DESCRIPTOR_POOL_SIZE 64
+#define MAX_SKINNING_JOINTS 16384 // joint matrices per frame, over all animators
+#define SKINNING_DESCRIPTOR_POOL_SIZE 64
+#define ANIMATION_COMPRESSION 1
+#define ANIMATION_KEY_ERROR 0.0001f // max deviation a dropped key may introduce
+#define ANIMATION_RESAMPLE_RATE 30.0f // keys per second for cubic spline channels
+#define ANIMATION_CHUNK 32 // animators per sampling job
+
+#define DEFAULT_SCENE_PATH "./data/default.scene"
+#define PIPELINE_CACHE_PATH "./data/pipeline.cache"
+#define STATIC_BATCHING 1
+#define STATIC_BATCH_CELL_SIZE 32.0f // world units per side of a batch cell
+
+#define TEXTURE_STREAMING 1
+#define TEXTURE_STREAMING_BUDGET (256ull * 1024 * 1024)
+#define TEXTURE_STREAMING_INITIAL_SIZE 128
+#define TEXTURE_STREAMING_UPLOADS_PER_FRAME 4
+#define TEXTURE_STREAMING_EVICT_FRAMES 120
+#define MAX_BINDLESS_TEXTURES 4096 // size of the texture array every draw indexes
+
+#define MULTI_DRAW_INDIRECT 1 // 0 records one vkCmdDrawIndexed per draw command
+#define GPU_CULLING 1 // frustum culls queued objects in a compute pass, needs multi draw indirect
+#define CPU_CULLING 1 // SSE frustum culling on the job system when the GPU does not cull
+#define CPU_CULLING_CHUNK 4096 // objects per culling job, a multiple of 4
+#define CULLING_VALIDATE 0 // also cull on the CPU and report frames where the GPU disagrees
+
+#define COMPUTE_MIPMAPS 1 // 0 blits the mips unless the format cannot be filtered
+#define DOWNSAMPLE_MAX_MIPS 13 // one dispatch covers textures up to 4096 texels a side
+#define DOWNSAMPLE_DESCRIPTOR_POOL_SIZE 64 // textures per upload batch before it is flushed
+#define DOWNSAMPLE_COUNTERS 256
+
+#define OBJECT_BUFFER_INITIAL_CAPACITY 1024 // objects per frame buffer, the buffers double when full
 
 
 // #define MAX_ENTITIES_COUNT 1024
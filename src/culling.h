@@ -0,0 +1,269 @@
+
+// ############################################################################
+// # culling
+// ############################################################################
+
+// inside where dot(plane.xyz, p) + plane.w >= 0, normals are unit length
+void
+frustum_planes(
+  const glm::mat4& viewProj,
+  glm::vec4* planes)
+{
+  // rows of the clip space transform, depth runs from 0 to w
+  glm::mat4 m = glm::transpose(viewProj);
+
+  planes[0] = m[3] + m[0];
+  planes[1] = m[3] - m[0];
+  planes[2] = m[3] + m[1];
+  planes[3] = m[3] - m[1];
+  planes[4] = m[2];
+  planes[5] = m[3] - m[2];
+
+  for (uint32_t i = 0; i < 6; i++)
+  {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+// World space bounding spheres of the render objects as structure of
+// arrays. Lanes are padded to a multiple of four, so the culler always
+// loads whole registers; padding lanes hold empty spheres at the origin.
+struct
+stSphereBoundsSoA
+{
+  void
+  Resize(
+    uint32_t count)
+  {
+    Count = count;
+
+    uint32_t lanes = (count + 3) & ~3u;
+    X.assign(lanes, 0.0f);
+    Y.assign(lanes, 0.0f);
+    Z.assign(lanes, 0.0f);
+    Radius.assign(lanes, 0.0f);
+  }
+
+  // sphere is center and radius in mesh space
+  void
+  Set(
+    uint32_t index,
+    const glm::mat4& transform,
+    const glm::vec4& sphere)
+  {
+    glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.0f));
+    float scale = glm::max(glm::length(glm::vec3(transform[0])), glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+    X[index] = center.x;
+    Y[index] = center.y;
+    Z[index] = center.z;
+    Radius[index] = sphere.w * scale;
+  }
+
+  std::vector<float> X;
+  std::vector<float> Y;
+  std::vector<float> Z;
+  std::vector<float> Radius;
+  uint32_t Count = 0;
+};
+
+// sets visible[i] for the spheres in [first, first + count) to 1 inside
+// the frustum and 0 outside, four spheres per test; first is a multiple
+// of four. Matches the test of cull.comp.
+void
+cull_spheres(
+  const stSphereBoundsSoA& bounds,
+  const glm::vec4* planes,
+  uint32_t first,
+  uint32_t count,
+  uint8_t* visible)
+{
+  __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+  for (uint32_t p = 0; p < 6; p++)
+  {
+    planeX[p] = _mm_set1_ps(planes[p].x);
+    planeY[p] = _mm_set1_ps(planes[p].y);
+    planeZ[p] = _mm_set1_ps(planes[p].z);
+    planeW[p] = _mm_set1_ps(planes[p].w);
+  }
+
+  const __m128 zero = _mm_setzero_ps();
+  uint32_t end = first + count;
+
+  for (uint32_t i = first; i < end; i += 4)
+  {
+    __m128 x = _mm_loadu_ps(&bounds.X[i]);
+    __m128 y = _mm_loadu_ps(&bounds.Y[i]);
+    __m128 z = _mm_loadu_ps(&bounds.Z[i]);
+    __m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(&bounds.Radius[i]));
+
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+    for (uint32_t p = 0; p < 6; p++)
+    {
+      __m128 distance = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+        _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+    }
+
+    int mask = _mm_movemask_ps(inside);
+    for (uint32_t lane = 0; lane < 4 && i + lane < end; lane++)
+    {
+      visible[i + lane] = (mask >> lane) & 1;
+    }
+  }
+}
+
+// one per queued object, in instance order
+struct
+stCullRecordGPU
+{
+  uint32_t Object = 0;  // into the object buffer
+  uint32_t Command = 0; // indirect command that draws it
+};
+
+struct
+stCullConstantsGPU
+{
+  glm::vec4 Planes[6];  // inside where dot(plane.xyz, p) + plane.w >= 0
+  uint32_t RecordCount = 0;
+};
+
+// Tests the world bounding sphere of every queued object against the
+// camera frustum on the GPU. A visible object bumps instanceCount of its indirect
+// command atomically and writes its index to the instance buffer at
+// firstInstance plus the old count; commands start at zero instances.
+struct
+stCullingPass
+{
+  void
+  Init(
+    const stDevice& device,
+    stDeletionQueue* deletionQueue);
+
+  // the buffers of one swapchain image, capacity in objects
+  void
+  WriteDescriptors(
+    uint32_t imageIndex,
+    VkBuffer objects,
+    VkBuffer records,
+    VkBuffer commands,
+    VkBuffer instances,
+    uint32_t capacity);
+
+  // records the dispatch and the barrier to the draws, outside of a render pass
+  void
+  Record(
+    VkCommandBuffer cmd,
+    uint32_t imageIndex,
+    const glm::mat4& viewProj,
+    uint32_t recordCount);
+
+  stDevice Device = {};
+
+  stComputePipeline Pipeline = {};
+
+  VkDescriptorPool DescriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet DescriptorSets[MAX_SWAPCHAIN_IMAGE_COUNT] = {};
+};
+
+void
+stCullingPass::Init(
+  const stDevice& device,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device;
+
+  // objects, cull records, indirect commands, instance indices
+  VkDescriptorSetLayoutBinding bindings[4] = {};
+  for (uint32_t i = 0; i < ArrayCount(bindings); i++)
+  {
+    bindings[i].binding = i;
+    bindings[i].descriptorCount = 1;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  Pipeline = init::create_compute_pipeline(
+    Device,
+    "./data/shaders/cull.comp.spv",
+    bindings,
+    ArrayCount(bindings),
+    sizeof(stCullConstantsGPU),
+    deletionQueue
+  );
+
+  VkDescriptorPoolSize poolSizes[] =
+  {
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_SWAPCHAIN_IMAGE_COUNT * ArrayCount(bindings) }
+  };
+
+  DescriptorPool = init::create_descriptor_pools(Device, poolSizes, ArrayCount(poolSizes), MAX_SWAPCHAIN_IMAGE_COUNT, deletionQueue);
+
+  VkDescriptorSetLayout layouts[MAX_SWAPCHAIN_IMAGE_COUNT];
+  for (uint32_t i = 0; i < MAX_SWAPCHAIN_IMAGE_COUNT; i++)
+  {
+    layouts[i] = Pipeline.SetLayout;
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+  allocInfo.descriptorPool = DescriptorPool;
+  allocInfo.descriptorSetCount = MAX_SWAPCHAIN_IMAGE_COUNT;
+  allocInfo.pSetLayouts = layouts;
+
+  VK_CHECK(vkAllocateDescriptorSets(Device.LogicalDevice, &allocInfo, DescriptorSets));
+}
+
+void
+stCullingPass::WriteDescriptors(
+  uint32_t imageIndex,
+  VkBuffer objects,
+  VkBuffer records,
+  VkBuffer commands,
+  VkBuffer instances,
+  uint32_t capacity)
+{
+  VkDescriptorBufferInfo bufferInfos[4] =
+  {
+    { objects, 0, VK_WHOLE_SIZE },
+    { records, 0, sizeof(stCullRecordGPU) * capacity },
+    { commands, 0, sizeof(VkDrawIndexedIndirectCommand) * capacity },
+    { instances, 0, sizeof(uint32_t) * capacity }
+  };
+
+  VkWriteDescriptorSet writes[4];
+  for (uint32_t i = 0; i < ArrayCount(writes); i++)
+  {
+    writes[i] = init::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, DescriptorSets[imageIndex], &bufferInfos[i], i);
+  }
+
+  vkUpdateDescriptorSets(Device.LogicalDevice, ArrayCount(writes), writes, 0, nullptr);
+}
+
+void
+stCullingPass::Record(
+  VkCommandBuffer cmd,
+  uint32_t imageIndex,
+  const glm::mat4& viewProj,
+  uint32_t recordCount)
+{
+  if (recordCount == 0)
+  {
+    return;
+  }
+
+  stCullConstantsGPU constants = {};
+  frustum_planes(viewProj, constants.Planes);
+  constants.RecordCount = recordCount;
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Layout, 0, 1, &DescriptorSets[imageIndex], 0, nullptr);
+  vkCmdPushConstants(cmd, Pipeline.Layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+  vkCmdDispatch(cmd, (recordCount + 63) / 64, 1, 1);
+
+  // the host reads the instance counts back to validate against the CPU culler
+  VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
@@ -0,0 +1,195 @@
+
+// ############################################################################
+// # deferred release
+// ############################################################################
+
+enum
+enReleaseType
+{
+  RELEASE_TYPE_BUFFER = 0,
+  RELEASE_TYPE_IMAGE = 1,
+  RELEASE_TYPE_IMAGE_VIEW = 2,
+  RELEASE_TYPE_SAMPLER = 3,
+  RELEASE_TYPE_DESCRIPTOR_POOL = 4,
+  RELEASE_TYPE_ALLOCATION = 5, // memory only, the handle is unused
+  RELEASE_TYPE_RANGE = 6       // Offset and Size go back to Ranges
+};
+
+struct
+stRelease
+{
+  enReleaseType Type = RELEASE_TYPE_BUFFER;
+  uint64_t Handle = 0;
+  stAllocation Allocation = {};
+  stRangeAllocator* Ranges = nullptr;
+  VkDeviceSize Offset = 0;
+  VkDeviceSize Size = 0;
+};
+
+// Objects the frames in flight may still use are released into the bucket
+// of the frame being recorded and destroyed when that frame's fence is
+// waited for again; the fence covers every earlier submission on the
+// graphics queue. Buckets keep their capacity, so a steady stream of
+// releases allocates nothing. Call begin_frame right after the wait.
+// Main thread only.
+namespace deferred
+{
+
+VkDevice Device = VK_NULL_HANDLE;
+std::vector<stRelease> Buckets[MAX_SWAPCHAIN_IMAGE_COUNT];
+uint32_t Current = 0;
+
+void
+destroy(
+  stRelease& release)
+{
+  switch (release.Type)
+  {
+    case RELEASE_TYPE_BUFFER:
+      vkDestroyBuffer(Device, (VkBuffer)release.Handle, nullptr);
+      break;
+    case RELEASE_TYPE_IMAGE:
+      vkDestroyImage(Device, (VkImage)release.Handle, nullptr);
+      break;
+    case RELEASE_TYPE_IMAGE_VIEW:
+      vkDestroyImageView(Device, (VkImageView)release.Handle, nullptr);
+      break;
+    case RELEASE_TYPE_SAMPLER:
+      vkDestroySampler(Device, (VkSampler)release.Handle, nullptr);
+      break;
+    case RELEASE_TYPE_DESCRIPTOR_POOL:
+      vkDestroyDescriptorPool(Device, (VkDescriptorPool)release.Handle, nullptr);
+      break;
+    case RELEASE_TYPE_ALLOCATION:
+      break;
+    case RELEASE_TYPE_RANGE:
+      release.Ranges->Free(release.Offset, release.Size);
+      break;
+  }
+
+  // after the object that was bound to it
+  memory::release(release.Allocation);
+}
+
+void
+flush_bucket(
+  uint32_t frame)
+{
+  for (stRelease& release : Buckets[frame])
+  {
+    destroy(release);
+  }
+  Buckets[frame].clear();
+}
+
+// destroys everything released so far, only once the device is idle
+void
+flush()
+{
+  for (uint32_t i = 0; i < MAX_SWAPCHAIN_IMAGE_COUNT; i++)
+  {
+    flush_bucket(i);
+  }
+}
+
+void
+init(
+  const stDevice& device,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device.LogicalDevice;
+
+  // before memory::term, which was pushed earlier
+  if (deletionQueue)
+  deletionQueue->PushFunction([=]{
+    flush();
+  });
+}
+
+// the fence of frame was just waited for, what it released is unused now
+void
+begin_frame(
+  uint32_t frame)
+{
+  assert(frame < MAX_SWAPCHAIN_IMAGE_COUNT);
+  flush_bucket(frame);
+  Current = frame;
+}
+
+void
+push(
+  const stRelease& release)
+{
+  Buckets[Current].push_back(release);
+}
+
+void
+handle(
+  enReleaseType type,
+  uint64_t handle)
+{
+  if (handle != 0)
+  {
+    stRelease release = {};
+    release.Type = type;
+    release.Handle = handle;
+    push(release);
+  }
+}
+
+void
+buffer(
+  stBuffer& buffer)
+{
+  stRelease release = {};
+  release.Type = RELEASE_TYPE_BUFFER;
+  release.Handle = (uint64_t)buffer.Buffer;
+  release.Allocation = buffer.Allocation;
+  push(release);
+
+  buffer = {};
+}
+
+// the view too, if the image has one
+void
+image(
+  stImage& image)
+{
+  handle(RELEASE_TYPE_IMAGE_VIEW, (uint64_t)image.View);
+
+  stRelease release = {};
+  release.Type = RELEASE_TYPE_IMAGE;
+  release.Handle = (uint64_t)image.Src;
+  release.Allocation = image.Allocation;
+  push(release);
+
+  image = {};
+}
+
+void
+allocation(
+  stAllocation& allocation)
+{
+  stRelease release = {};
+  release.Type = RELEASE_TYPE_ALLOCATION;
+  release.Allocation = allocation;
+  push(release);
+
+  allocation = {};
+}
+
+void
+range(
+  stRangeAllocator* ranges,
+  VkDeviceSize offset,
+  VkDeviceSize size)
+{
+  stRelease release = {};
+  release.Type = RELEASE_TYPE_RANGE;
+  release.Ranges = ranges;
+  release.Offset = offset;
+  release.Size = size;
+  push(release);
+}
+
+}
@@ -0,0 +1,273 @@
+
+// ############################################################################
+// # downsample
+// ############################################################################
+
+// Builds every mip of an rgba8 texture in one compute dispatch instead of
+// a blit and two barriers per level. Each workgroup reduces a 64x64 tile of
+// mip 0 to mips 1-6 in shared memory; the last workgroup to finish, found
+// through a counter in Counters, reduces mip 6 to the rest. sRGB textures
+// are filtered in linear space. Storage views use the unorm format, so the
+// image needs MUTABLE_FORMAT and EXTENDED_USAGE. Recorded into the pending
+// upload batch, main thread only.
+namespace downsample
+{
+
+struct
+stConstantsGPU
+{
+  uint32_t MipCount = 0;
+  uint32_t Width = 0;
+  uint32_t Height = 0;
+  uint32_t WorkgroupCount = 0;
+  uint32_t Srgb = 0;
+  uint32_t Counter = 0; // slot in Counters
+};
+
+// mip views, atomic counters
+VkDescriptorSetLayoutBinding Bindings[] =
+{
+  { 0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, DOWNSAMPLE_MAX_MIPS, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+  { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr }
+};
+
+stDevice Device = {};
+stComputePipeline Pipeline = {};
+bool Supported = false;
+
+VkDescriptorPool DescriptorPool = VK_NULL_HANDLE;
+stBuffer Counters = {}; // every slot is back at zero when its dispatch ends
+uint32_t NextCounter = 0;
+
+bool
+supported(
+  uint32_t mipLevels)
+{
+  return Supported && mipLevels > 1 && mipLevels <= DOWNSAMPLE_MAX_MIPS;
+}
+
+void
+term()
+{
+  if (DescriptorPool != VK_NULL_HANDLE)
+  {
+    vkDestroyDescriptorPool(Device.LogicalDevice, DescriptorPool, nullptr);
+  }
+  if (Counters.Buffer != VK_NULL_HANDLE)
+  {
+    vkDestroyBuffer(Device.LogicalDevice, Counters.Buffer, nullptr);
+    memory::release(Counters.Allocation);
+  }
+
+  DescriptorPool = VK_NULL_HANDLE;
+  Counters = {};
+  Supported = false;
+}
+
+// the pipeline is made from Bindings, downsample.comp.spv and
+// stConstantsGPU; call before the first texture is created
+void
+init(
+  const stDevice& device,
+  const stComputePipeline& pipeline,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device;
+  Pipeline = pipeline;
+
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(device.PhysicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+  Supported = formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+
+  if (!Supported)
+  {
+    printf("Mipmaps fall back to blits, no rgba8 storage images\n");
+    return;
+  }
+
+  VkDescriptorPoolSize poolSizes[] =
+  {
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, DOWNSAMPLE_DESCRIPTOR_POOL_SIZE * DOWNSAMPLE_MAX_MIPS },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, DOWNSAMPLE_DESCRIPTOR_POOL_SIZE }
+  };
+
+  VkDescriptorPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+  poolInfo.maxSets = DOWNSAMPLE_DESCRIPTOR_POOL_SIZE;
+  poolInfo.poolSizeCount = ArrayCount(poolSizes);
+  poolInfo.pPoolSizes = poolSizes;
+
+  VK_CHECK(vkCreateDescriptorPool(Device.LogicalDevice, &poolInfo, nullptr, &DescriptorPool));
+
+  VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+  bufferInfo.size = sizeof(uint32_t) * DOWNSAMPLE_COUNTERS;
+  bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  VK_CHECK(vkCreateBuffer(Device.LogicalDevice, &bufferInfo, nullptr, &Counters.Buffer));
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(Device.LogicalDevice, Counters.Buffer, &memRequirements);
+
+  Counters.Allocation = memory::allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_CATEGORY_BUFFER);
+  VK_CHECK(vkBindBufferMemory(Device.LogicalDevice, Counters.Buffer, Counters.Allocation.Memory, Counters.Allocation.Offset));
+
+  // the batch's final barrier orders the fill before the first dispatch
+  vkCmdFillBuffer(upload::graphics_cmd(), Counters.Buffer, 0, VK_WHOLE_SIZE, 0);
+
+  if (deletionQueue)
+  deletionQueue->PushFunction([=]{
+    term();
+  });
+}
+
+VkDescriptorSet
+allocate_descriptor_set()
+{
+  VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+  allocInfo.descriptorPool = DescriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &Pipeline.SetLayout;
+
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkResult result = vkAllocateDescriptorSets(Device.LogicalDevice, &allocInfo, &descriptorSet);
+
+  // every set is freed with its batch, finish the pending ones
+  if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+  {
+    upload::wait();
+    result = vkAllocateDescriptorSets(Device.LogicalDevice, &allocInfo, &descriptorSet);
+  }
+
+  VK_CHECK(result);
+  return descriptorSet;
+}
+
+// records into upload::graphics_cmd(); expects every mip in
+// TRANSFER_DST_OPTIMAL with mip 0 written and leaves them in
+// SHADER_READ_ONLY_OPTIMAL for the fragment shader, like
+// init::generate_mipmaps
+void
+record(
+  VkImage image,
+  bool srgb,
+  uint32_t width,
+  uint32_t height,
+  uint32_t mipLevels)
+{
+  assert(supported(mipLevels));
+
+  // may submit the pending batch, so before anything is recorded
+  VkDescriptorSet descriptorSet = allocate_descriptor_set();
+  VkCommandBuffer cmd = upload::graphics_cmd();
+
+  VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = mipLevels;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  // a slot is reused only after the dispatch that used it last
+  if (NextCounter == DOWNSAMPLE_COUNTERS)
+  {
+    VkMemoryBarrier counterBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    counterBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &counterBarrier, 0, nullptr, 0, nullptr);
+    NextCounter = 0;
+  }
+
+  VkImageView views[DOWNSAMPLE_MAX_MIPS] = {};
+  VkDescriptorImageInfo imageInfos[DOWNSAMPLE_MAX_MIPS] = {};
+
+  for (uint32_t i = 0; i < DOWNSAMPLE_MAX_MIPS; i++)
+  {
+    if (i < mipLevels)
+    {
+      VkImageViewCreateInfo viewInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+      viewInfo.image = image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+      viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      viewInfo.subresourceRange.baseMipLevel = i;
+      viewInfo.subresourceRange.levelCount = 1;
+      viewInfo.subresourceRange.baseArrayLayer = 0;
+      viewInfo.subresourceRange.layerCount = 1;
+
+      VK_CHECK(vkCreateImageView(Device.LogicalDevice, &viewInfo, nullptr, &views[i]));
+    }
+
+    // the shader never touches slots past mipLevels, they only need to be valid
+    imageInfos[i].imageView = views[utils::Min(i, mipLevels - 1)];
+    imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  }
+
+  VkDescriptorBufferInfo counterInfo = { Counters.Buffer, 0, VK_WHOLE_SIZE };
+
+  VkWriteDescriptorSet writes[2] = {};
+  writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  writes[0].dstSet = descriptorSet;
+  writes[0].dstBinding = 0;
+  writes[0].descriptorCount = DOWNSAMPLE_MAX_MIPS;
+  writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  writes[0].pImageInfo = imageInfos;
+
+  writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  writes[1].dstSet = descriptorSet;
+  writes[1].dstBinding = 1;
+  writes[1].descriptorCount = 1;
+  writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  writes[1].pBufferInfo = &counterInfo;
+
+  vkUpdateDescriptorSets(Device.LogicalDevice, ArrayCount(writes), writes, 0, nullptr);
+
+  stConstantsGPU constants = {};
+  constants.MipCount = mipLevels;
+  constants.Width = width;
+  constants.Height = height;
+  constants.Srgb = srgb ? 1 : 0;
+  constants.Counter = NextCounter++;
+
+  uint32_t groupsX = (width + 63) / 64;
+  uint32_t groupsY = (height + 63) / 64;
+  constants.WorkgroupCount = groupsX * groupsY;
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Layout, 0, 1, &descriptorSet, 0, nullptr);
+  vkCmdPushConstants(cmd, Pipeline.Layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+  vkCmdDispatch(cmd, groupsX, groupsY, 1);
+
+  barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  VkDevice device = Device.LogicalDevice;
+  VkDescriptorPool pool = DescriptorPool;
+  std::array<VkImageView, DOWNSAMPLE_MAX_MIPS> retired = {};
+  std::copy(views, views + DOWNSAMPLE_MAX_MIPS, retired.begin());
+
+  upload::defer([=]{
+    for (VkImageView view : retired)
+    {
+      if (view != VK_NULL_HANDLE)
+      {
+        vkDestroyImageView(device, view, nullptr);
+      }
+    }
+    vkFreeDescriptorSets(device, pool, 1, &descriptorSet);
+  });
+}
+
+}
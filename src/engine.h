@@ -2,6 +2,9 @@
 const static f64 FIXED_TIME = 1.0 / 60.0;
 
 #include "font.h"
+#include "resource_table.h"
+#include "jobs.h"
+#include "animation.h"
 #include "mesh.h"
 #include "transform.h"
 #include "physics.h"
@@ -32,6 +35,10 @@ engine
   stTransformSystem TransformSystem;
   stPhysicsSystem PhysicsSystem;
 
+  stJobSystem Jobs;
+
+  stAnimationSystem AnimationSystem;
+
   bool
   Run()
   {
@@ -47,6 +54,8 @@ engine
 
     PhysicsSystem.TransformSystem = &TransformSystem;
 
+    Jobs.Init(glm::max(std::thread::hardware_concurrency(), 2u) - 1);
+
     // "./data/models/pirate/pirate.obj"
     // "./data/models/sponza/sponza.obj"
     // "./data/models/mandalorian/mandalorian.obj"
@@ -54,12 +63,12 @@ engine
     // "./data/models/bunny/bunny.obj"
     // "./data/models/cube/cube.obj"
 
-    mesh::load_mesh("./data/models/cube/cube.obj");
+    mesh::load_mesh("./data/models/cube/cube.obj", &Jobs);
     int startIndex, mshCount;
     //mesh::load_gltf_mesh("./data/models/shiba/scene.gltf", startIndex, mshCount);
-    mesh::load_gltf_mesh("./data/models/lost-empire/loast-empire.gltf", startIndex, mshCount);
+    mesh::load_gltf_mesh("./data/models/lost-empire/loast-empire.gltf", startIndex, mshCount, &Jobs);
     //mesh::load_gltf_mesh("./data/models/Sponza/Sponza.gltf", startIndex, mshCount);
-    mesh::load_gltf_mesh("./data/models/hairball/hairball.gltf", startIndex, mshCount);
+    mesh::load_gltf_mesh("./data/models/hairball/hairball.gltf", startIndex, mshCount, &Jobs);
     //mesh::load_gltf_mesh("./data/models/box/BoxVertexColors.gltf", startIndex, mshCount);
     //mesh::load_gltf_mesh("./data/models/sun/sun.gltf", startIndex, mshCount);
     // mesh::load_gltf_mesh("./data/models/cube/cube.gltf", startIndex, mshCount);
@@ -95,10 +104,21 @@ engine
 
     Renderer.Camera = &SceneCamera;
     Renderer.Sun = &Sun;
+    Renderer.Animation = &AnimationSystem;
+    Renderer.Transforms = &TransformSystem;
+    Renderer.Jobs = &Jobs;
     Renderer.Init(Window);
 
     stScene scene;
-    scene.Load(EntitySystem, TransformSystem);
+    if (!scene.Load(EntitySystem, TransformSystem, DEFAULT_SCENE_PATH, &Jobs))
+    {
+      scene.CreateDefault(EntitySystem, TransformSystem);
+      scene.Save(DEFAULT_SCENE_PATH);
+    }
+
+#if STATIC_BATCHING
+    scene.CombineMeshes(EntitySystem, TransformSystem);
+#endif
 
     while (IsRunning)
     {
@@ -140,6 +160,8 @@ engine
         timer += FIXED_TIME;
       }
 
+      AnimationSystem.Update((float)delta, &Jobs);
+
       Renderer.Render(delta);
 
       sys::SwapBuffers(Window);
@@ -147,6 +169,8 @@ engine
 
     Renderer.Term();
 
+    Jobs.Term();
+
     return 0;
   }
 
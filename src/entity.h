@@ -18,8 +18,7 @@ stEntity
 
   stEntity() {}
 
-  stMesh* Mesh[MAX_ENTITY_MESH_COUNT];
-  uint32_t MeshCount = 0;
+  mesh::stMeshRange Meshes;
   stTransform Transform;
   stEntity* Childrens[MAX_ENTITY_CILDRENS];
   stEntity* Parent = nullptr;
@@ -52,17 +51,11 @@ create_entity(stEntitySystem& entitySystem, stTransformSystem& transformSystem,
 
   if (meshPath)
   {
-    std::vector<stMesh*> meshes = mesh::get_meshes(meshPath);
-    for (size_t i = 0; i < meshes.size(); i++)
-    {
-      base.Entity->Mesh[i] = meshes[i];
-      base.Entity->MeshCount++;
-    }
+    base.Entity->Meshes = mesh::get_asset(meshPath);
   }
-  else
+  else if (mesh::Meshes.IsAlive(index))
   {
-    base.Entity->Mesh[0] = mesh::get_mesh(index);
-    base.Entity->MeshCount++;
+    base.Entity->Meshes = mesh::index_range(mesh::Meshes.HandleOf(index));
   }
 
   return base;
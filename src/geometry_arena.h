@@ -0,0 +1,194 @@
+
+// ############################################################################
+// # geometry arena
+// ############################################################################
+
+struct
+stGeometryRange
+{
+  int32_t VertexOffset = 0; // vertexOffset of vkCmdDrawIndexed
+  uint32_t VertexCount = 0;
+  uint32_t FirstIndex = 0;
+  uint32_t IndexCount = 0;
+};
+
+// One device local vertex buffer and one index buffer shared by every mesh,
+// so a frame binds geometry once. Ranges are handed out in vertices and
+// indices; a full buffer is replaced by one twice as large and the old
+// contents are copied over in the pending upload batch.
+struct
+stGeometryArena
+{
+  void
+  Init(
+    const stDevice& device,
+    stDeletionQueue* deletionQueue);
+
+  // growing swaps the buffers, rebind before drawing the range
+  stGeometryRange
+  Add(
+    const stMesh& mesh,
+    bool vertices = true);
+
+  // the range is handed out again once the frames in flight are done
+  void
+  Remove(
+    stGeometryRange& range);
+
+  void
+  Bind(
+    VkCommandBuffer cmd);
+
+  void
+  Grow(
+    stBuffer& buffer,
+    stRangeAllocator& ranges,
+    VkDeviceSize elementSize,
+    VkDeviceSize elementCount,
+    VkBufferUsageFlags usage);
+
+  void
+  Upload(
+    const void* data,
+    VkDeviceSize size,
+    VkBuffer buffer,
+    VkDeviceSize offset);
+
+  stDevice Device = {};
+  stDeletionQueue* DeletionQueue = nullptr;
+
+  stBuffer VertexBuffer = {};
+  stBuffer IndexBuffer = {};
+  stRangeAllocator VertexRanges;
+  stRangeAllocator IndexRanges;
+};
+
+void
+stGeometryArena::Init(
+  const stDevice& device,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device;
+  DeletionQueue = deletionQueue;
+
+  Grow(VertexBuffer, VertexRanges, sizeof(stVertex), GEOMETRY_ARENA_VERTICES, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+  Grow(IndexBuffer, IndexRanges, sizeof(uint32_t), GEOMETRY_ARENA_INDICES, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+  DeletionQueue->PushFunction([=]{
+    init::destroy_buffer(Device, VertexBuffer);
+    init::destroy_buffer(Device, IndexBuffer);
+  });
+}
+
+stGeometryRange
+stGeometryArena::Add(
+  const stMesh& mesh,
+  bool vertices /*= true*/)
+{
+  stGeometryRange range = {};
+  VkDeviceSize offset = 0;
+
+  if (vertices && !mesh.Vertices.empty())
+  {
+    while (!VertexRanges.Allocate(mesh.Vertices.size(), 1, &offset))
+    {
+      Grow(VertexBuffer, VertexRanges, sizeof(stVertex), VertexRanges.Capacity * 2, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    }
+
+    range.VertexOffset = (int32_t)offset;
+    range.VertexCount = (uint32_t)mesh.Vertices.size();
+    Upload(mesh.Vertices.data(), sizeof(stVertex) * mesh.Vertices.size(), VertexBuffer.Buffer, sizeof(stVertex) * offset);
+  }
+
+  if (!mesh.Indices.empty())
+  {
+    while (!IndexRanges.Allocate(mesh.Indices.size(), 1, &offset))
+    {
+      Grow(IndexBuffer, IndexRanges, sizeof(uint32_t), IndexRanges.Capacity * 2, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    }
+
+    range.FirstIndex = (uint32_t)offset;
+    range.IndexCount = (uint32_t)mesh.Indices.size();
+    Upload(mesh.Indices.data(), sizeof(uint32_t) * mesh.Indices.size(), IndexBuffer.Buffer, sizeof(uint32_t) * offset);
+  }
+
+  return range;
+}
+
+void
+stGeometryArena::Remove(
+  stGeometryRange& range)
+{
+  if (range.VertexCount > 0)
+  {
+    deferred::range(&VertexRanges, range.VertexOffset, range.VertexCount);
+  }
+  if (range.IndexCount > 0)
+  {
+    deferred::range(&IndexRanges, range.FirstIndex, range.IndexCount);
+  }
+  range = {};
+}
+
+void
+stGeometryArena::Bind(
+  VkCommandBuffer cmd)
+{
+  VkDeviceSize offset = 0;
+  vkCmdBindVertexBuffers(cmd, 0, 1, &VertexBuffer.Buffer, &offset);
+  vkCmdBindIndexBuffer(cmd, IndexBuffer.Buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void
+stGeometryArena::Grow(
+  stBuffer& buffer,
+  stRangeAllocator& ranges,
+  VkDeviceSize elementSize,
+  VkDeviceSize elementCount,
+  VkBufferUsageFlags usage)
+{
+  stBuffer grown = {};
+  init::create_buffer(
+    Device,
+    elementSize * elementCount,
+    usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    grown, nullptr,
+    true
+  );
+
+  if (buffer.Buffer != VK_NULL_HANDLE)
+  {
+    VkCommandBuffer cmd = upload::cmd();
+
+    // uploads recorded earlier in the batch may still write the old buffer
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy region = {};
+    region.size = elementSize * ranges.Capacity;
+    vkCmdCopyBuffer(cmd, buffer.Buffer, grown.Buffer, 1, &region);
+
+    // frames in flight may still draw from the old buffer
+    upload::retire(buffer);
+    ranges.Grow(elementCount);
+  }
+  else
+  {
+    ranges.Init(elementCount);
+  }
+
+  buffer = grown;
+}
+
+void
+stGeometryArena::Upload(
+  const void* data,
+  VkDeviceSize size,
+  VkBuffer buffer,
+  VkDeviceSize offset)
+{
+  upload::buffer(buffer, offset, data, size);
+}
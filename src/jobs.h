@@ -0,0 +1,124 @@
+
+// ############################################################################
+// # job system
+// ############################################################################
+
+// Fixed pool of worker threads fed from one queue. The thread that waits
+// helps drain the queue, so a pool with no workers still runs every job.
+struct
+stJobSystem
+{
+  void
+  Init(
+    uint32_t workerCount)
+  {
+    Running = true;
+
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+      Workers.emplace_back([this]{ WorkerLoop(); });
+    }
+  }
+
+  void
+  Term()
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Running = false;
+    }
+    WakeCondition.notify_all();
+
+    for (std::thread& worker : Workers)
+    {
+      worker.join();
+    }
+    Workers.clear();
+  }
+
+  void
+  Submit(
+    std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Queue.push_back(std::move(job));
+      Pending++;
+    }
+    WakeCondition.notify_one();
+  }
+
+  // runs job(i) for every i in [0, count) and returns once all are done
+  void
+  ParallelFor(
+    uint32_t count,
+    const std::function<void(uint32_t)>& job)
+  {
+    for (uint32_t i = 0; i < count; i++)
+    {
+      Submit([&job, i]{ job(i); });
+    }
+    Wait();
+  }
+
+  void
+  Wait()
+  {
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    while (Pending > 0)
+    {
+      if (!Queue.empty())
+      {
+        std::function<void()> job = std::move(Queue.front());
+        Queue.pop_front();
+
+        lock.unlock();
+        job();
+        lock.lock();
+
+        Pending--;
+      }
+      else
+      {
+        IdleCondition.wait(lock);
+      }
+    }
+  }
+
+  void
+  WorkerLoop()
+  {
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    while (true)
+    {
+      WakeCondition.wait(lock, [this]{ return !Queue.empty() || !Running; });
+
+      if (Queue.empty())
+      {
+        return;
+      }
+
+      std::function<void()> job = std::move(Queue.front());
+      Queue.pop_front();
+
+      lock.unlock();
+      job();
+      lock.lock();
+
+      if (--Pending == 0)
+      {
+        IdleCondition.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> Workers;
+  std::deque<std::function<void()>> Queue;
+  std::mutex Mutex;
+  std::condition_variable WakeCondition;
+  std::condition_variable IdleCondition;
+  uint32_t Pending = 0;
+  bool Running = false;
+};
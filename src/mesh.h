@@ -8,13 +8,80 @@ stVertex
 	alignas(16) glm::vec2 TexCoord = { 0.0f, 0.0f };
 };
 
+// offsets one morph target applies to a vertex, padded like stVertex
+struct
+stMorphDelta
+{
+  alignas(16) glm::vec3 Position = { 0.0f, 0.0f, 0.0f };
+  alignas(16) glm::vec3 Normal = { 0.0f, 0.0f, 0.0f };
+};
+
+// up to four joints per vertex, laid out for the skinning shader
+struct
+stSkinVertex
+{
+  glm::uvec4 Joints = { 0, 0, 0, 0 };
+  glm::vec4 Weights = { 0.0f, 0.0f, 0.0f, 0.0f };
+};
+
+enum
+enAlphaMode
+{
+  ALPHA_MODE_OPAQUE = 0,
+  ALPHA_MODE_MASK = 1,
+  ALPHA_MODE_BLEND = 2
+};
+
+enum
+enSurfaceTexture
+{
+  SURFACE_TEXTURE_METALLIC_ROUGHNESS = 0,
+  SURFACE_TEXTURE_NORMAL = 1,
+  SURFACE_TEXTURE_OCCLUSION = 2,
+  SURFACE_TEXTURE_EMISSIVE = 3,
+  SURFACE_TEXTURE_COUNT = 4
+};
+
+// glTF metallic-roughness material of a primitive. The base color texture
+// stays in stMesh::TexturePath, empty paths are unused textures.
+struct
+stSurfaceMaterial
+{
+  std::string Name; // "<asset>#<material index>", empty for the default material
+  glm::vec4 BaseColorFactor = { 1.0f, 1.0f, 1.0f, 1.0f };
+  glm::vec3 EmissiveFactor = { 0.0f, 0.0f, 0.0f };
+  float MetallicFactor = 1.0f;
+  float RoughnessFactor = 1.0f;
+  float NormalScale = 1.0f;
+  float OcclusionStrength = 1.0f;
+  float AlphaCutoff = 0.5f;
+  enAlphaMode AlphaMode = ALPHA_MODE_OPAQUE;
+  bool DoubleSided = false;
+  std::string Textures[SURFACE_TEXTURE_COUNT];
+};
+
 struct
 stMesh
 {
   std::vector<stVertex> Vertices;
   std::vector<uint32_t> Indices;
   std::string TexturePath;
+  stSurfaceMaterial Surface;
   glm::mat4 RootMatrix = glm::mat4(1.0f);
+
+  // target-major: MorphDeltas[target * Vertices.size() + vertex]
+  uint32_t MorphTargetCount = 0;
+  std::vector<stMorphDelta> MorphDeltas;
+  std::vector<float> MorphWeights; // default weights of the glTF mesh
+
+  // JOINTS_0/WEIGHTS_0, only kept when a node binds the mesh to a skin
+  std::vector<stSkinVertex> SkinVertices;
+  stSkeletonHandle Skeleton;
+
+  // mesh space, from compute_bounds; the sphere is around the box center
+  glm::vec3 BoundsMin = glm::vec3(0.0f);
+  glm::vec3 BoundsMax = glm::vec3(0.0f);
+  glm::vec4 Sphere = glm::vec4(0.0f); // center, radius
 };
 
 static void fixupIndices(std::vector<unsigned int>& indices, cgltf_primitive_type& type)
@@ -107,15 +174,629 @@ static void fixupIndices(std::vector<unsigned int>& indices, cgltf_primitive_typ
 namespace mesh
 {
 
-std::unordered_map<std::string, stMesh*> CachedMeshes;
-stMesh Meshes[MAX_MESH_COUNT];
-// stMesh *Meshes = (stMesh*) calloc(MAX_MESH_COUNT, sizeof(stMesh));
+typedef stHandle<stMesh> stMeshHandle;
+
+// primitives of one source asset, stored back to back in AssetMeshes;
+// the generation tells a range from whatever reused its slice later
+struct
+stMeshRange
+{
+  uint32_t First = 0;
+  uint32_t Count = 0;
+  uint32_t Generation = 0;
+};
+
+stResourceTable<stMesh> Meshes;
+std::unordered_map<std::string, stMeshHandle> CachedMeshes;
+std::unordered_map<std::string, stMeshRange> Assets;
+std::unordered_map<std::string, uint32_t> AssetUsers; // scenes holding each asset
+std::vector<stMeshHandle> AssetMeshes;
+std::vector<uint32_t> AssetMeshGenerations; // per AssetMeshes element, 0 while free
+uint32_t RangeGeneration = 0;
+std::vector<stMeshRange> FreeRanges; // holes in AssetMeshes left by unloads
+std::unordered_map<uint32_t, stMeshRange> IndexRanges; // mesh slot -> range of that mesh alone
+
+// reuses the first hole that fits, the rest of it stays free
+stMeshRange
+make_range(
+  const std::vector<stMeshHandle>& handles)
+{
+  stMeshRange range = {};
+  range.Count = (uint32_t)handles.size();
+  if (range.Count == 0)
+  {
+    return range;
+  }
+
+  range.Generation = ++RangeGeneration;
+
+  for (size_t i = 0; i < FreeRanges.size(); i++)
+  {
+    stMeshRange& hole = FreeRanges[i];
+    if (hole.Count < range.Count)
+    {
+      continue;
+    }
+
+    range.First = hole.First;
+    hole.First += range.Count;
+    hole.Count -= range.Count;
+    if (hole.Count == 0)
+    {
+      FreeRanges[i] = FreeRanges.back();
+      FreeRanges.pop_back();
+    }
+
+    std::copy(handles.begin(), handles.end(), AssetMeshes.begin() + range.First);
+    std::fill(AssetMeshGenerations.begin() + range.First, AssetMeshGenerations.begin() + range.First + range.Count, range.Generation);
+    return range;
+  }
+
+  range.First = (uint32_t)AssetMeshes.size();
+  AssetMeshes.insert(AssetMeshes.end(), handles.begin(), handles.end());
+  AssetMeshGenerations.resize(AssetMeshes.size(), range.Generation);
+  return range;
+}
+
+// an invalid handle once the range was freed, its slice may hold other meshes
+stMeshHandle
+get_asset_mesh(
+  const stMeshRange& range,
+  uint32_t index)
+{
+  uint64_t slot = (uint64_t)range.First + index;
+  if (index >= range.Count
+    || slot >= AssetMeshes.size()
+    || AssetMeshGenerations[slot] != range.Generation)
+  {
+    return {};
+  }
+
+  return AssetMeshes[slot];
+}
+
+void
+free_range(
+  const stMeshRange& range)
+{
+  // already freed
+  if (range.Count == 0
+    || range.First >= AssetMeshGenerations.size()
+    || AssetMeshGenerations[range.First] != range.Generation)
+  {
+    return;
+  }
+
+  std::fill(AssetMeshes.begin() + range.First, AssetMeshes.begin() + range.First + range.Count, stMeshHandle{});
+  std::fill(AssetMeshGenerations.begin() + range.First, AssetMeshGenerations.begin() + range.First + range.Count, 0);
+
+  if (range.First + range.Count == AssetMeshes.size())
+  {
+    AssetMeshes.resize(range.First);
+    AssetMeshGenerations.resize(range.First);
+  }
+  else
+  {
+    FreeRanges.push_back(range);
+  }
+}
+
+// range of a single mesh, shared by every entity created from its index
+stMeshRange
+index_range(
+  stMeshHandle handle)
+{
+  auto it = IndexRanges.find(handle.Index);
+  if (it != IndexRanges.end())
+  {
+    if (get_asset_mesh(it->second, 0) == handle)
+    {
+      return it->second;
+    }
+
+    // the slot was freed and reused since
+    free_range(it->second);
+  }
+
+  stMeshRange range = make_range({ handle });
+  IndexRanges[handle.Index] = range;
+  return range;
+}
+
+// of the base pose, morph targets and skinning may move vertices outside
+void
+compute_bounds(
+  stMesh& mesh)
+{
+  if (mesh.Vertices.empty())
+  {
+    mesh.BoundsMin = mesh.BoundsMax = glm::vec3(0.0f);
+    mesh.Sphere = glm::vec4(0.0f);
+    return;
+  }
+
+  glm::vec3 min = mesh.Vertices[0].Position;
+  glm::vec3 max = min;
+
+  for (const stVertex& vertex : mesh.Vertices)
+  {
+    min = glm::min(min, vertex.Position);
+    max = glm::max(max, vertex.Position);
+  }
+
+  glm::vec3 center = 0.5f * (min + max);
+
+  float radiusSq = 0.0f;
+  for (const stVertex& vertex : mesh.Vertices)
+  {
+    glm::vec3 offset = vertex.Position - center;
+    radiusSq = glm::max(radiusSq, glm::dot(offset, offset));
+  }
+
+  mesh.BoundsMin = min;
+  mesh.BoundsMax = max;
+  mesh.Sphere = glm::vec4(center, sqrtf(radiusSq));
+}
+
+// loaders register an asset once its meshes are complete, bounds included
+stMeshRange
+register_asset(
+  const char* path,
+  const std::vector<stMeshHandle>& handles)
+{
+  for (stMeshHandle handle : handles)
+  {
+    if (stMesh* mesh = Meshes.Get(handle))
+    {
+      compute_bounds(*mesh);
+    }
+  }
+
+  stMeshRange range = make_range(handles);
+  Assets[path] = range;
+  return range;
+}
+
+void
+run_jobs(
+  stJobSystem* jobs,
+  uint32_t count,
+  const std::function<void(uint32_t)>& job)
+{
+  if (jobs)
+  {
+    jobs->ParallelFor(count, job);
+    return;
+  }
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    job(i);
+  }
+}
+
+#define MESH_CACHE_MAGIC 0x4853454D // "MESH"
+#define MESH_CACHE_VERSION 4
+
+#define MESH_CACHE_ENCODED_VERTICES 0x1
+#define MESH_CACHE_ENCODED_INDICES 0x2
+#define MESH_CACHE_ENCODED_MORPHS 0x4
+
+// .mesh file: header, one stCookedMesh per primitive, then the name,
+// texture path, surface strings, vertex, index, morph weight and morph
+// delta streams of each primitive back to back. Streams are meshopt
+// encoded when the matching flag is set. The source size and write time
+// are kept to recook a changed asset.
+struct
+stCookedMeshHeader
+{
+  uint32_t Magic = MESH_CACHE_MAGIC;
+  uint32_t Version = MESH_CACHE_VERSION;
+  uint32_t MeshCount = 0;
+  uint32_t Reserved = 0;
+  uint64_t SourceSize = 0;
+  uint64_t SourceTime = 0;
+};
+
+// stSurfaceMaterial without its strings; the material name and texture
+// paths follow the base color texture path
+struct
+stCookedSurface
+{
+  glm::vec4 BaseColorFactor = glm::vec4(1.0f);
+  glm::vec4 EmissiveFactor = glm::vec4(0.0f);
+  float MetallicFactor = 1.0f;
+  float RoughnessFactor = 1.0f;
+  float NormalScale = 1.0f;
+  float OcclusionStrength = 1.0f;
+  float AlphaCutoff = 0.5f;
+  uint32_t AlphaMode = ALPHA_MODE_OPAQUE;
+  uint32_t DoubleSided = 0;
+  uint32_t NameLength = 0;
+  uint32_t TextureLengths[SURFACE_TEXTURE_COUNT] = {};
+};
+
+struct
+stCookedMesh
+{
+  uint32_t Flags = 0;
+  uint32_t VertexCount = 0;
+  uint32_t IndexCount = 0;
+  uint32_t NameLength = 0;
+  uint32_t TexturePathLength = 0;
+  uint32_t VertexBytes = 0;
+  uint32_t IndexBytes = 0;
+  uint32_t MorphTargetCount = 0;
+  uint32_t MorphBytes = 0;
+  uint32_t Reserved = 0;
+  uint64_t Offset = 0;
+  glm::mat4 RootMatrix = glm::mat4(1.0f);
+  stCookedSurface Surface;
+};
+
+// name, texture path and surface strings in front of the streams
+uint64_t
+cooked_string_bytes(
+  const stCookedMesh& record)
+{
+  uint64_t bytes = record.NameLength + record.TexturePathLength + record.Surface.NameLength;
+  for (uint32_t t = 0; t < SURFACE_TEXTURE_COUNT; t++)
+  {
+    bytes += record.Surface.TextureLengths[t];
+  }
+  return bytes;
+}
+
+bool
+cook_meshes(
+  const char* path,
+  const char* cookedPath,
+  const std::vector<stMeshHandle>& handles,
+  const std::vector<std::string>& names,
+  stJobSystem* jobs)
+{
+  uint32_t count = (uint32_t)handles.size();
+
+  std::vector<stCookedMesh> records(count);
+  std::vector<std::vector<uint8_t>> vertexStreams(count);
+  std::vector<std::vector<uint8_t>> indexStreams(count);
+  std::vector<std::vector<uint8_t>> morphStreams(count);
+
+  run_jobs(jobs, count, [&](uint32_t i)
+  {
+    const stMesh* mesh = Meshes.Get(handles[i]);
+    stCookedMesh& record = records[i];
+
+    record.VertexCount = (uint32_t)mesh->Vertices.size();
+    record.IndexCount = (uint32_t)mesh->Indices.size();
+    record.NameLength = (uint32_t)names[i].size();
+    record.TexturePathLength = (uint32_t)mesh->TexturePath.size();
+    record.RootMatrix = mesh->RootMatrix;
+    record.MorphTargetCount = mesh->MorphTargetCount;
+
+    const stSurfaceMaterial& surface = mesh->Surface;
+    record.Surface.BaseColorFactor = surface.BaseColorFactor;
+    record.Surface.EmissiveFactor = glm::vec4(surface.EmissiveFactor, 0.0f);
+    record.Surface.MetallicFactor = surface.MetallicFactor;
+    record.Surface.RoughnessFactor = surface.RoughnessFactor;
+    record.Surface.NormalScale = surface.NormalScale;
+    record.Surface.OcclusionStrength = surface.OcclusionStrength;
+    record.Surface.AlphaCutoff = surface.AlphaCutoff;
+    record.Surface.AlphaMode = surface.AlphaMode;
+    record.Surface.DoubleSided = surface.DoubleSided;
+    record.Surface.NameLength = (uint32_t)surface.Name.size();
+    for (uint32_t t = 0; t < SURFACE_TEXTURE_COUNT; t++)
+    {
+      record.Surface.TextureLengths[t] = (uint32_t)surface.Textures[t].size();
+    }
+
+    // copy field by field over zeroed memory so the alignment padding
+    // is deterministic and costs nothing once encoded
+    std::vector<stVertex> vertices(record.VertexCount);
+    memset(vertices.data(), 0, vertices.size() * sizeof(stVertex));
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+      vertices[v].Position = mesh->Vertices[v].Position;
+      vertices[v].Normal = mesh->Vertices[v].Normal;
+      vertices[v].Color = mesh->Vertices[v].Color;
+      vertices[v].TexCoord = mesh->Vertices[v].TexCoord;
+    }
+
+    std::vector<stMorphDelta> deltas(mesh->MorphDeltas.size());
+    memset(deltas.data(), 0, deltas.size() * sizeof(stMorphDelta));
+    for (size_t d = 0; d < deltas.size(); d++)
+    {
+      deltas[d].Position = mesh->MorphDeltas[d].Position;
+      deltas[d].Normal = mesh->MorphDeltas[d].Normal;
+    }
+
+    std::vector<uint8_t>& vertexStream = vertexStreams[i];
+    std::vector<uint8_t>& indexStream = indexStreams[i];
+    std::vector<uint8_t>& morphStream = morphStreams[i];
+
+    morphStream.assign((const uint8_t*)mesh->MorphWeights.data(), (const uint8_t*)(mesh->MorphWeights.data() + mesh->MorphWeights.size()));
+
+#if MESH_CACHE_ENCODE
+    vertexStream.resize(meshopt_encodeVertexBufferBound(vertices.size(), sizeof(stVertex)));
+    vertexStream.resize(meshopt_encodeVertexBuffer(vertexStream.data(), vertexStream.size(), vertices.data(), vertices.size(), sizeof(stVertex)));
+    record.Flags |= MESH_CACHE_ENCODED_VERTICES;
+
+    // the index codec only takes triangle lists
+    if (record.IndexCount % 3 == 0)
+    {
+      indexStream.resize(meshopt_encodeIndexBufferBound(record.IndexCount, record.VertexCount));
+      indexStream.resize(meshopt_encodeIndexBuffer(indexStream.data(), indexStream.size(), mesh->Indices.data(), mesh->Indices.size()));
+      record.Flags |= MESH_CACHE_ENCODED_INDICES;
+    }
+
+    // deltas are mostly zero, the vertex codec squeezes them well
+    if (!deltas.empty())
+    {
+      size_t weightBytes = morphStream.size();
+      morphStream.resize(weightBytes + meshopt_encodeVertexBufferBound(deltas.size(), sizeof(stMorphDelta)));
+      morphStream.resize(weightBytes + meshopt_encodeVertexBuffer(morphStream.data() + weightBytes, morphStream.size() - weightBytes, deltas.data(), deltas.size(), sizeof(stMorphDelta)));
+      record.Flags |= MESH_CACHE_ENCODED_MORPHS;
+    }
+#else
+    vertexStream.assign((const uint8_t*)vertices.data(), (const uint8_t*)(vertices.data() + vertices.size()));
+    morphStream.insert(morphStream.end(), (const uint8_t*)deltas.data(), (const uint8_t*)(deltas.data() + deltas.size()));
+#endif
+
+    if (!(record.Flags & MESH_CACHE_ENCODED_INDICES))
+    {
+      indexStream.assign((const uint8_t*)mesh->Indices.data(), (const uint8_t*)(mesh->Indices.data() + mesh->Indices.size()));
+    }
+
+    record.VertexBytes = (uint32_t)vertexStream.size();
+    record.IndexBytes = (uint32_t)indexStream.size();
+    record.MorphBytes = (uint32_t)morphStream.size();
+  });
+
+  uint64_t offset = sizeof(stCookedMeshHeader) + sizeof(stCookedMesh) * count;
+  for (stCookedMesh& record : records)
+  {
+    record.Offset = offset;
+    offset += cooked_string_bytes(record) + record.VertexBytes + record.IndexBytes + record.MorphBytes;
+  }
+
+  FILE* file = fopen(cookedPath, "wb");
+  if (!file)
+  {
+    printf("Error writing %s\n", cookedPath);
+    return false;
+  }
+
+  stCookedMeshHeader header = {};
+  header.MeshCount = count;
+  utils::FileStamp(path, &header.SourceSize, &header.SourceTime);
+
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(records.data(), sizeof(stCookedMesh), count, file);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    const stMesh* mesh = Meshes.Get(handles[i]);
+
+    fwrite(names[i].data(), 1, names[i].size(), file);
+    fwrite(mesh->TexturePath.data(), 1, mesh->TexturePath.size(), file);
+    fwrite(mesh->Surface.Name.data(), 1, mesh->Surface.Name.size(), file);
+    for (uint32_t t = 0; t < SURFACE_TEXTURE_COUNT; t++)
+    {
+      fwrite(mesh->Surface.Textures[t].data(), 1, mesh->Surface.Textures[t].size(), file);
+    }
+    fwrite(vertexStreams[i].data(), 1, vertexStreams[i].size(), file);
+    fwrite(indexStreams[i].data(), 1, indexStreams[i].size(), file);
+    fwrite(morphStreams[i].data(), 1, morphStreams[i].size(), file);
+  }
+  fclose(file);
+
+  return true;
+}
+
+// reads the whole .mesh in one go and decodes the primitives across the
+// job system straight into their vertex and index arrays
+bool
+load_cooked_meshes(
+  const char* path,
+  const char* cookedPath,
+  stJobSystem* jobs)
+{
+  FILE* file = fopen(cookedPath, "rb");
+  if (!file)
+  {
+    return false;
+  }
+
+  // long is 32 bits on windows, caches can pass 2 GB
+  _fseeki64(file, 0, SEEK_END);
+  __int64 fileSize = _ftelli64(file);
+  _fseeki64(file, 0, SEEK_SET);
+
+  std::vector<uint8_t> data(fileSize > 0 ? (size_t)fileSize : 0);
+  size_t read = data.empty() ? 0 : fread(data.data(), data.size(), 1, file);
+  fclose(file);
+
+  if (read != 1 || data.size() < sizeof(stCookedMeshHeader))
+  {
+    return false;
+  }
+
+  const stCookedMeshHeader* header = (const stCookedMeshHeader*)data.data();
+  if (header->Magic != MESH_CACHE_MAGIC
+    || header->Version != MESH_CACHE_VERSION
+    || data.size() < sizeof(stCookedMeshHeader) + sizeof(stCookedMesh) * (uint64_t)header->MeshCount)
+  {
+    return false;
+  }
+
+  // a changed source is cooked again, a missing one keeps the cache usable
+  uint64_t sourceSize, sourceTime;
+  if (utils::FileStamp(path, &sourceSize, &sourceTime)
+    && (header->SourceSize != sourceSize || header->SourceTime != sourceTime))
+  {
+    return false;
+  }
+
+  const stCookedMesh* records = (const stCookedMesh*)(data.data() + sizeof(stCookedMeshHeader));
+
+  for (uint32_t i = 0; i < header->MeshCount; i++)
+  {
+    const stCookedMesh& record = records[i];
+    if (record.Offset + cooked_string_bytes(record) + record.VertexBytes + record.IndexBytes + record.MorphBytes > data.size())
+    {
+      return false;
+    }
+  }
+
+  // the table is not thread safe, so slots are created up front
+  std::vector<stMeshHandle> handles(header->MeshCount);
+  for (uint32_t i = 0; i < header->MeshCount; i++)
+  {
+    const stCookedMesh& record = records[i];
+    const char* strings = (const char*)data.data() + record.Offset;
+
+    handles[i] = Meshes.Create();
+    stMesh* mesh = Meshes.Get(handles[i]);
+
+    strings += record.NameLength;
+    mesh->TexturePath.assign(strings, record.TexturePathLength);
+    strings += record.TexturePathLength;
+
+    stSurfaceMaterial& surface = mesh->Surface;
+    surface.BaseColorFactor = record.Surface.BaseColorFactor;
+    surface.EmissiveFactor = glm::vec3(record.Surface.EmissiveFactor);
+    surface.MetallicFactor = record.Surface.MetallicFactor;
+    surface.RoughnessFactor = record.Surface.RoughnessFactor;
+    surface.NormalScale = record.Surface.NormalScale;
+    surface.OcclusionStrength = record.Surface.OcclusionStrength;
+    surface.AlphaCutoff = record.Surface.AlphaCutoff;
+    surface.AlphaMode = (enAlphaMode)record.Surface.AlphaMode;
+    surface.DoubleSided = record.Surface.DoubleSided != 0;
+    surface.Name.assign(strings, record.Surface.NameLength);
+    strings += record.Surface.NameLength;
+    for (uint32_t t = 0; t < SURFACE_TEXTURE_COUNT; t++)
+    {
+      surface.Textures[t].assign(strings, record.Surface.TextureLengths[t]);
+      strings += record.Surface.TextureLengths[t];
+    }
+
+    mesh->RootMatrix = record.RootMatrix;
+    mesh->Vertices.resize(record.VertexCount);
+    mesh->Indices.resize(record.IndexCount);
+    mesh->MorphTargetCount = record.MorphTargetCount;
+    mesh->MorphWeights.resize(record.MorphTargetCount);
+    mesh->MorphDeltas.resize((size_t)record.MorphTargetCount * record.VertexCount);
+  }
+
+  std::atomic<bool> decoded(true);
+
+  run_jobs(jobs, header->MeshCount, [&](uint32_t i)
+  {
+    const stCookedMesh& record = records[i];
+    const uint8_t* vertexStream = data.data() + record.Offset + cooked_string_bytes(record);
+    const uint8_t* indexStream = vertexStream + record.VertexBytes;
+    const uint8_t* morphStream = indexStream + record.IndexBytes;
+    stMesh* mesh = Meshes.Get(handles[i]);
+
+    if (record.Flags & MESH_CACHE_ENCODED_VERTICES)
+    {
+      if (meshopt_decodeVertexBuffer(mesh->Vertices.data(), record.VertexCount, sizeof(stVertex), vertexStream, record.VertexBytes) != 0)
+      {
+        decoded = false;
+      }
+    }
+    else if (record.VertexBytes == record.VertexCount * sizeof(stVertex))
+    {
+      memcpy(mesh->Vertices.data(), vertexStream, record.VertexBytes);
+    }
+    else
+    {
+      decoded = false;
+    }
+
+    if (record.Flags & MESH_CACHE_ENCODED_INDICES)
+    {
+      if (meshopt_decodeIndexBuffer(mesh->Indices.data(), record.IndexCount, sizeof(uint32_t), indexStream, record.IndexBytes) != 0)
+      {
+        decoded = false;
+      }
+    }
+    else if (record.IndexBytes == record.IndexCount * sizeof(uint32_t))
+    {
+      memcpy(mesh->Indices.data(), indexStream, record.IndexBytes);
+    }
+    else
+    {
+      decoded = false;
+    }
+
+    size_t weightBytes = mesh->MorphWeights.size() * sizeof(float);
+    size_t deltaBytes = mesh->MorphDeltas.size() * sizeof(stMorphDelta);
+
+    if (record.MorphBytes < weightBytes)
+    {
+      decoded = false;
+      return;
+    }
+
+    memcpy(mesh->MorphWeights.data(), morphStream, weightBytes);
+
+    if (record.Flags & MESH_CACHE_ENCODED_MORPHS)
+    {
+      if (meshopt_decodeVertexBuffer(mesh->MorphDeltas.data(), mesh->MorphDeltas.size(), sizeof(stMorphDelta), morphStream + weightBytes, record.MorphBytes - weightBytes) != 0)
+      {
+        decoded = false;
+      }
+    }
+    else if (record.MorphBytes == weightBytes + deltaBytes)
+    {
+      memcpy(mesh->MorphDeltas.data(), morphStream + weightBytes, deltaBytes);
+    }
+    else
+    {
+      decoded = false;
+    }
+  });
+
+  if (!decoded)
+  {
+    printf("Warning: %s is corrupt, loading %s instead\n", cookedPath, path);
+    for (stMeshHandle handle : handles)
+    {
+      Meshes.Free(handle);
+    }
+    return false;
+  }
+
+  for (uint32_t i = 0; i < header->MeshCount; i++)
+  {
+    const char* name = (const char*)data.data() + records[i].Offset;
+    CachedMeshes.insert( { std::string(name, records[i].NameLength), handles[i] } );
+  }
+
+  register_asset(path, handles);
 
-uint32_t MesheCounter = 0;
+  return true;
+}
 
-bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
+bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount, stJobSystem* jobs = nullptr)
 {
-	// stMesh* mesh = &Meshes[MesheCounter++];
+  auto loaded = Assets.find(path);
+
+#if MESH_CACHE
+  std::string cookedPath = std::string(path) + ".mesh";
+
+  if (loaded == Assets.end() && load_cooked_meshes(path, cookedPath.c_str(), jobs))
+  {
+    loaded = Assets.find(path);
+  }
+#endif
+
+  if (loaded != Assets.end())
+  {
+    startIndex = loaded->second.First;
+    meshCount = loaded->second.Count;
+    return true;
+  }
 
   std::string mesh_path = path;
   mesh_path = mesh_path.substr(0, mesh_path.find_last_of("\\/") + 1);
@@ -142,10 +823,10 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
 	for (size_t mi = 0; mi < data->meshes_count; ++mi)
 		total_primitives += data->meshes[mi].primitives_count;
 
-//   stMesh* meshes = &Meshes[MesheCounter];
-  startIndex = MesheCounter;
-  MesheCounter += total_primitives;
-  meshCount = total_primitives;
+  std::vector<stMeshHandle> handles;
+  std::vector<std::string> names;
+  handles.reserve(total_primitives);
+  names.reserve(total_primitives);
 
   //meshes->Vertices.clear();
   //meshes->Indices.clear();
@@ -154,6 +835,23 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
 	// mesh_remap.resize(data->meshes_count);
 
   
+  // skins become skeletons, the node -> joint maps resolve animation targets
+  std::vector<stSkeletonHandle> skeletons(data->skins_count);
+  std::vector<std::unordered_map<const cgltf_node*, uint32_t>> jointIndices(data->skins_count);
+
+  for (size_t si = 0; si < data->skins_count; ++si)
+    skeletons[si] = anim::load_gltf_skeleton(data->skins[si], jointIndices[si]);
+
+  // a mesh is skinned by the node that instances it
+  std::unordered_map<const cgltf_mesh*, stSkeletonHandle> meshSkeletons;
+
+  for (size_t ni = 0; ni < data->nodes_count; ++ni)
+  {
+    const cgltf_node& node = data->nodes[ni];
+    if (node.mesh && node.skin)
+      meshSkeletons[node.mesh] = skeletons[node.skin - data->skins];
+  }
+
   glm::mat4 RootMatrix = glm::mat4{ 1 };//glm::rotate(glm::mat4{ 1 }, 90.0f * 0.01745329251f, { 1.0f,0.0f,0.0f });
   //for (size_t i = 0; i < data->nodes_count; i++)
   //{
@@ -169,7 +867,6 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
   //  RootMatrix *= mat;
   //}
 
-  int index = 0;
 	for (size_t mi = 0; mi < data->meshes_count; ++mi)
 	{
 		const cgltf_mesh& mesh = data->meshes[mi];
@@ -189,7 +886,9 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
 			//meshes.push_back(Mesh());
 			//Mesh& result = meshes.back();
 
-      stMesh* result_mesh = &Meshes[startIndex + index++];
+      stMeshHandle handle = Meshes.Create();
+      handles.push_back(handle);
+      stMesh* result_mesh = Meshes.Get(handle);
 
       result_mesh->RootMatrix = RootMatrix;      
 
@@ -283,6 +982,33 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
           }
         }
 
+        if (attr.type == cgltf_attribute_type_joints && attr.index == 0)
+        {
+          result_mesh->SkinVertices.resize(attr.data->count);
+
+          for (size_t v = 0; v < attr.data->count; v++)
+          {
+            cgltf_uint joints[4] = {};
+            cgltf_accessor_read_uint(attr.data, v, joints, 4);
+
+            result_mesh->SkinVertices[v].Joints = glm::uvec4(joints[0], joints[1], joints[2], joints[3]);
+          }
+        }
+
+        if (attr.type == cgltf_attribute_type_weights && attr.index == 0)
+        {
+          std::vector<cgltf_float> data_u;
+	        data_u.resize(attr.data->count * 4);
+	        cgltf_accessor_unpack_floats(attr.data, data_u.data(), data_u.size());
+
+          result_mesh->SkinVertices.resize(attr.data->count);
+
+          for (size_t v = 0; v < attr.data->count; v++)
+          {
+            result_mesh->SkinVertices[v].Weights = glm::vec4(data_u[v * 4 + 0], data_u[v * 4 + 1], data_u[v * 4 + 2], data_u[v * 4 + 3]);
+          }
+        }
+
         if (attr.type == cgltf_attribute_type_texcoord)
         {
           std::vector<cgltf_float> data_u;
@@ -328,9 +1054,25 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
 				//}
 			}
 
+			size_t vertexCount = result_mesh->Vertices.size();
+
+			auto skin = meshSkeletons.find(&mesh);
+			if (skin != meshSkeletons.end() && result_mesh->SkinVertices.size() == vertexCount)
+				result_mesh->Skeleton = skin->second;
+			else
+				result_mesh->SkinVertices.clear();
+
+			result_mesh->MorphTargetCount = (uint32_t)primitive.targets_count;
+			result_mesh->MorphDeltas.resize(primitive.targets_count * vertexCount);
+			result_mesh->MorphWeights.assign(primitive.targets_count, 0.0f);
+
+			for (size_t wi = 0; wi < mesh.weights_count && wi < primitive.targets_count; ++wi)
+				result_mesh->MorphWeights[wi] = mesh.weights[wi];
+
 			for (size_t ti = 0; ti < primitive.targets_count; ++ti)
 			{
 				const cgltf_morph_target& target = primitive.targets[ti];
+				stMorphDelta* deltas = &result_mesh->MorphDeltas[ti * vertexCount];
 
 				for (size_t ai = 0; ai < target.attributes_count; ++ai)
 				{
@@ -342,24 +1084,30 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
 						continue;
 					}
 
-          if (attr.type == cgltf_attribute_type_position)
-          {
-            // attr.data->buffer_view
-            //const uint8_t* data = cgltf_buffer_view_data(attr.data->buffer_view);
-
-            //glm::vec3 vector = *(glm::vec3*)(data);
+					if (attr.type != cgltf_attribute_type_position && attr.type != cgltf_attribute_type_normal)
+					{
+						continue;
+					}
 
-            // printf("May prem count: %d\n", attr.data->count);
-          }
+					if (attr.data->count != vertexCount)
+					{
+						fprintf(stderr, "Warning: ignoring morph target %d of primitive %d of mesh %d, vertex count mismatch\n", int(ti), int(pi), int(mi));
+						continue;
+					}
 
-					//result.streams.push_back(Stream());
-					//Stream& s = result.streams.back();
+					std::vector<cgltf_float> data_u;
+					data_u.resize(attr.data->count * 3);
+					cgltf_accessor_unpack_floats(attr.data, data_u.data(), data_u.size());
 
-					//s.type = attr.type;
-					//s.index = attr.index;
-					//s.target = int(ti + 1);
+					for (size_t v = 0; v < vertexCount; v++)
+					{
+						glm::vec3 delta = glm::vec3(data_u[v * 3 + 0], data_u[v * 3 + 1], data_u[v * 3 + 2]);
 
-					//readAccessor(s.data, attr.data);
+						if (attr.type == cgltf_attribute_type_position)
+							deltas[v].Position = delta;
+						else
+							deltas[v].Normal = delta;
+					}
 				}
 			}
 
@@ -373,17 +1121,71 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
 
       //data->materials[primitive.material->pbr_metallic_roughness.base_color_texture.texture->name].pbr_metallic_roughness.base_color_texture.texture->name
 
-      if (primitive.material->pbr_metallic_roughness.base_color_texture.texture)
-      result_mesh->TexturePath = mesh_path + primitive.material->pbr_metallic_roughness.base_color_texture.texture->image->uri; //data->images->uri;
+      if (primitive.material)
+      {
+        const cgltf_material& material = *primitive.material;
+        stSurfaceMaterial& surface = result_mesh->Surface;
+
+        auto texturePath = [&mesh_path](const cgltf_texture_view& view)
+        {
+          return view.texture && view.texture->image && view.texture->image->uri
+            ? mesh_path + view.texture->image->uri
+            : std::string();
+        };
+
+        surface.Name = std::string(path) + "#" + std::to_string(primitive.material - data->materials);
+
+        if (material.has_pbr_metallic_roughness)
+        {
+          const cgltf_pbr_metallic_roughness& pbr = material.pbr_metallic_roughness;
+
+          surface.BaseColorFactor = glm::vec4(pbr.base_color_factor[0], pbr.base_color_factor[1], pbr.base_color_factor[2], pbr.base_color_factor[3]);
+          surface.MetallicFactor = pbr.metallic_factor;
+          surface.RoughnessFactor = pbr.roughness_factor;
 
-      //primitive.material->pbr_metallic_roughness.base_color_texture.texture->image->uri
+          result_mesh->TexturePath = texturePath(pbr.base_color_texture);
+          surface.Textures[SURFACE_TEXTURE_METALLIC_ROUGHNESS] = texturePath(pbr.metallic_roughness_texture);
+        }
 
-      CachedMeshes.insert( { meshName , result_mesh } );
+        surface.Textures[SURFACE_TEXTURE_NORMAL] = texturePath(material.normal_texture);
+        surface.Textures[SURFACE_TEXTURE_OCCLUSION] = texturePath(material.occlusion_texture);
+        surface.Textures[SURFACE_TEXTURE_EMISSIVE] = texturePath(material.emissive_texture);
+
+        // scale is only parsed for views that are present
+        if (material.normal_texture.texture)
+          surface.NormalScale = material.normal_texture.scale;
+        if (material.occlusion_texture.texture)
+          surface.OcclusionStrength = material.occlusion_texture.scale;
+
+        surface.EmissiveFactor = glm::vec3(material.emissive_factor[0], material.emissive_factor[1], material.emissive_factor[2]);
+        surface.AlphaMode = material.alpha_mode == cgltf_alpha_mode_mask ? ALPHA_MODE_MASK
+          : material.alpha_mode == cgltf_alpha_mode_blend ? ALPHA_MODE_BLEND
+          : ALPHA_MODE_OPAQUE;
+        surface.AlphaCutoff = material.alpha_cutoff;
+        surface.DoubleSided = material.double_sided != 0;
+      }
+
+      CachedMeshes.insert( { meshName , handle } );
+      names.push_back(meshName);
 		}
 
 		// mesh_remap[mi] = std::make_pair(remap_offset, meshes.size());
 	}
 
+  stMeshRange range = register_asset(path, handles);
+  startIndex = range.First;
+  meshCount = range.Count;
+
+  anim::load_gltf_clips(data, path, skeletons, jointIndices);
+
+#if MESH_CACHE
+  // the cache has no room for skins and clips yet, animated assets load from source
+  if (data->skins_count == 0 && data->animations_count == 0)
+  {
+    cook_meshes(path, cookedPath.c_str(), handles, names, jobs);
+  }
+#endif
+
   //#####################################################################
   //#####################################################################
 
@@ -391,9 +1193,22 @@ bool load_gltf_mesh(const char* path, int& startIndex, int& meshCount)
 	return true;
 }
 
-bool load_mesh(const char* path)
+bool load_mesh(const char* path, stJobSystem* jobs = nullptr)
 {
-  stMesh* mesh = &Meshes[MesheCounter++];
+  if (Assets.find(path) != Assets.end())
+  {
+    return true;
+  }
+
+#if MESH_CACHE
+  std::string cookedPath = std::string(path) + ".mesh";
+
+  if (load_cooked_meshes(path, cookedPath.c_str(), jobs))
+  {
+    return true;
+  }
+#endif
+
   fastObjMesh* obj = fast_obj_read(path);
   if (!obj)
   {
@@ -401,6 +1216,9 @@ bool load_mesh(const char* path)
   	return false;
   }
 
+  stMeshHandle handle = Meshes.Create();
+  stMesh* mesh = Meshes.Get(handle);
+
   mesh->Vertices.clear();
   mesh->Indices.clear();
 
@@ -460,7 +1278,12 @@ bool load_mesh(const char* path)
   mesh->Vertices.resize(total_vertices);
   meshopt_remapVertexBuffer(&mesh->Vertices[0], &vertices[0], total_indices, sizeof(stVertex), &remap[0]);
 
-  CachedMeshes.insert( { path, mesh } );
+  CachedMeshes.insert( { path, handle } );
+  register_asset(path, { handle });
+
+#if MESH_CACHE
+  cook_meshes(path, cookedPath.c_str(), { handle }, { path }, jobs);
+#endif
 
   return true;
 }
@@ -486,11 +1309,99 @@ test(
   return true;
 }
 
+// frees every primitive of the asset and its range; handles and ranges
+// still held elsewhere go stale
+void
+unload_asset(
+  const char* path)
+{
+  auto it = Assets.find(path);
+  if (it == Assets.end())
+  {
+    return;
+  }
+
+  for (uint32_t i = 0; i < it->second.Count; i++)
+  {
+    Meshes.Free(get_asset_mesh(it->second, i));
+  }
+
+  for (auto cached = CachedMeshes.begin(); cached != CachedMeshes.end();)
+  {
+    if (!Meshes.Get(cached->second))
+    {
+      cached = CachedMeshes.erase(cached);
+    }
+    else
+    {
+      ++cached;
+    }
+  }
+
+  for (auto single = IndexRanges.begin(); single != IndexRanges.end();)
+  {
+    if (!Meshes.Get(get_asset_mesh(single->second, 0)))
+    {
+      free_range(single->second);
+      single = IndexRanges.erase(single);
+    }
+    else
+    {
+      ++single;
+    }
+  }
+
+  free_range(it->second);
+  Assets.erase(it);
+}
+
+// scenes share assets by path, the last one to release an asset unloads it
+void
+acquire_asset(
+  const char* path)
+{
+  AssetUsers[path]++;
+}
+
+void
+release_asset(
+  const char* path)
+{
+  auto it = AssetUsers.find(path);
+  if (it == AssetUsers.end())
+  {
+    return;
+  }
+
+  if (--it->second == 0)
+  {
+    AssetUsers.erase(it);
+    unload_asset(path);
+  }
+}
+
+stMesh*
+get_mesh(
+  stMeshHandle handle)
+{
+  return Meshes.Get(handle);
+}
+
 stMesh*
 get_mesh(
   const char* name)
 {
-  return CachedMeshes[name];
+  auto it = CachedMeshes.find(name);
+  return it != CachedMeshes.end() ? Meshes.Get(it->second) : nullptr;
+}
+
+
+stMeshRange
+get_asset(
+  const char* path)
+{
+  auto it = Assets.find(path);
+  return it != Assets.end() ? it->second : stMeshRange{};
 }
 
 std::vector<stMesh*>
@@ -498,11 +1409,26 @@ get_meshes(
   const char* name)
 {
   std::vector<stMesh*> meshes;
+
+  auto it = Assets.find(name);
+  if (it != Assets.end())
+  {
+    for (uint32_t i = 0; i < it->second.Count; i++)
+    {
+      stMesh* mesh = Meshes.Get(get_asset_mesh(it->second, i));
+      if (mesh)
+      {
+        meshes.push_back(mesh);
+      }
+    }
+    return meshes;
+  }
+
   for (auto&& mesh : CachedMeshes)
   {
     if (mesh.first.find(name) != std::string::npos)
     {
-      meshes.push_back(mesh.second);
+      meshes.push_back(Meshes.Get(mesh.second));
     }
   }
   return meshes;
@@ -512,7 +1438,7 @@ stMesh*
 get_mesh(
   int index)
 {
-  return &Meshes[index];
+  return Meshes.IsAlive(index) ? &Meshes.Slot(index) : nullptr;
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,311 @@
+
+// ############################################################################
+// # morph targets
+// ############################################################################
+
+struct
+stMorphConstantsGPU
+{
+  uint32_t VertexCount = 0;
+  uint32_t TargetCount = 0;
+  uint32_t Padding[2] = {};
+  uint32_t Targets[MAX_MORPH_ACTIVE_TARGETS] = {};
+  float Weights[MAX_MORPH_ACTIVE_TARGETS] = {};
+};
+
+// Blends morph targets on the GPU. Each morphed mesh keeps its deltas in a
+// storage buffer and owns an output vertex buffer that is drawn instead of
+// the base one; both live until Remove. Record only dispatches meshes whose weights changed since
+// the last blend, using the MAX_MORPH_ACTIVE_TARGETS heaviest weights.
+struct
+stMorphPass
+{
+  struct
+  stMorphedMesh
+  {
+    mesh::stMeshHandle Mesh;
+    stBuffer Deltas = {};
+    stBuffer Output = {};
+    VkDescriptorSet DescriptorSet = VK_NULL_HANDLE;
+    uint32_t VertexCount = 0;
+    uint32_t TargetCount = 0;
+    std::vector<float> Weights;
+    bool Dirty = true;
+  };
+
+  void
+  Init(
+    const stDevice& device,
+    VkCommandPool commandPool,
+    stDeletionQueue* deletionQueue);
+
+  // returns the buffer to draw in place of baseVertices, which needs
+  // storage buffer usage
+  stBuffer
+  Add(
+    mesh::stMeshHandle handle,
+    const stMesh& mesh,
+    const stBuffer& baseVertices);
+
+  // releases the buffers of the mesh through the deferred buckets, its
+  // descriptor set stays allocated until the pool goes
+  void
+  Remove(
+    mesh::stMeshHandle handle);
+
+  void
+  SetWeights(
+    mesh::stMeshHandle handle,
+    const float* weights,
+    uint32_t count);
+
+  // records the dispatches, outside of a render pass
+  void
+  Record(
+    VkCommandBuffer cmd);
+
+  stMorphedMesh*
+  Find(
+    mesh::stMeshHandle handle)
+  {
+    if (handle.Index >= MeshIndices.size() || MeshIndices[handle.Index] < 0)
+    {
+      return nullptr;
+    }
+
+    stMorphedMesh* morphed = &Meshes[MeshIndices[handle.Index]];
+    return morphed->Mesh == handle ? morphed : nullptr;
+  }
+
+  stDevice Device = {};
+  VkCommandPool CommandPool = VK_NULL_HANDLE;
+  stDeletionQueue* DeletionQueue = nullptr;
+
+  stComputePipeline Pipeline = {};
+
+  VkDescriptorPool DescriptorPool = VK_NULL_HANDLE;
+  uint32_t DescriptorPoolFill = 0;
+
+  std::vector<stMorphedMesh> Meshes;
+  std::vector<int32_t> MeshIndices; // mesh slot -> Meshes index
+};
+
+void
+stMorphPass::Init(
+  const stDevice& device,
+  VkCommandPool commandPool,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device;
+  CommandPool = commandPool;
+  DeletionQueue = deletionQueue;
+
+  // base vertices, deltas, output vertices
+  VkDescriptorSetLayoutBinding bindings[3] = {};
+  for (uint32_t i = 0; i < ArrayCount(bindings); i++)
+  {
+    bindings[i].binding = i;
+    bindings[i].descriptorCount = 1;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  Pipeline = init::create_compute_pipeline(
+    Device,
+    "./data/shaders/morph.comp.spv",
+    bindings,
+    ArrayCount(bindings),
+    sizeof(stMorphConstantsGPU),
+    DeletionQueue
+  );
+}
+
+stBuffer
+stMorphPass::Add(
+  mesh::stMeshHandle handle,
+  const stMesh& mesh,
+  const stBuffer& baseVertices)
+{
+  stMorphedMesh morphed = {};
+  morphed.Mesh = handle;
+  morphed.VertexCount = (uint32_t)mesh.Vertices.size();
+  morphed.TargetCount = mesh.MorphTargetCount;
+  morphed.Weights = mesh.MorphWeights;
+
+  VkDeviceSize vertexBytes = sizeof(stVertex) * mesh.Vertices.size();
+  VkDeviceSize deltaBytes = sizeof(stMorphDelta) * mesh.MorphDeltas.size();
+
+  morphed.Deltas = init::create_device_buffer(
+    Device,
+    CommandPool,
+    mesh.MorphDeltas.data(),
+    deltaBytes,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+  );
+
+  init::create_buffer(
+    Device,
+    vertexBytes,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    morphed.Output,
+    nullptr
+  );
+
+  if (DescriptorPool == VK_NULL_HANDLE || DescriptorPoolFill == MORPH_DESCRIPTOR_POOL_SIZE)
+  {
+    VkDescriptorPoolSize poolSizes[] =
+    {
+      { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MORPH_DESCRIPTOR_POOL_SIZE * 3 }
+    };
+
+    DescriptorPool = init::create_descriptor_pools(Device, poolSizes, ArrayCount(poolSizes), MORPH_DESCRIPTOR_POOL_SIZE, DeletionQueue);
+    DescriptorPoolFill = 0;
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+  allocInfo.descriptorPool = DescriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &Pipeline.SetLayout;
+
+  VK_CHECK(vkAllocateDescriptorSets(Device.LogicalDevice, &allocInfo, &morphed.DescriptorSet));
+  DescriptorPoolFill++;
+
+  VkDescriptorBufferInfo bufferInfos[3] =
+  {
+    { baseVertices.Buffer, 0, vertexBytes },
+    { morphed.Deltas.Buffer, 0, deltaBytes },
+    { morphed.Output.Buffer, 0, vertexBytes }
+  };
+
+  VkWriteDescriptorSet writes[3];
+  for (uint32_t i = 0; i < ArrayCount(writes); i++)
+  {
+    writes[i] = init::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, morphed.DescriptorSet, &bufferInfos[i], i);
+  }
+
+  vkUpdateDescriptorSets(Device.LogicalDevice, ArrayCount(writes), writes, 0, nullptr);
+
+  if (MeshIndices.size() <= handle.Index)
+  {
+    MeshIndices.resize(handle.Index + 1, -1);
+  }
+  MeshIndices[handle.Index] = (int32_t)Meshes.size();
+  Meshes.push_back(morphed);
+
+  return morphed.Output;
+}
+
+void
+stMorphPass::Remove(
+  mesh::stMeshHandle handle)
+{
+  stMorphedMesh* morphed = Find(handle);
+  if (!morphed)
+  {
+    return;
+  }
+
+  deferred::buffer(morphed->Deltas);
+  deferred::buffer(morphed->Output);
+
+  // the last entry fills the gap
+  int32_t index = MeshIndices[handle.Index];
+  MeshIndices[handle.Index] = -1;
+
+  if (index + 1 < (int32_t)Meshes.size())
+  {
+    Meshes[index] = std::move(Meshes.back());
+    MeshIndices[Meshes[index].Mesh.Index] = index;
+  }
+  Meshes.pop_back();
+}
+
+void
+stMorphPass::SetWeights(
+  mesh::stMeshHandle handle,
+  const float* weights,
+  uint32_t count)
+{
+  stMorphedMesh* morphed = Find(handle);
+  if (!morphed)
+  {
+    return;
+  }
+
+  count = glm::min(count, morphed->TargetCount);
+
+  if (memcmp(morphed->Weights.data(), weights, count * sizeof(float)) != 0)
+  {
+    memcpy(morphed->Weights.data(), weights, count * sizeof(float));
+    morphed->Dirty = true;
+  }
+}
+
+void
+stMorphPass::Record(
+  VkCommandBuffer cmd)
+{
+  std::vector<VkBufferMemoryBarrier> barriers;
+
+  for (stMorphedMesh& morphed : Meshes)
+  {
+    if (!morphed.Dirty || !mesh::get_mesh(morphed.Mesh))
+    {
+      continue;
+    }
+
+    if (barriers.empty())
+    {
+      // the previous frame may still be fetching or skinning the output vertices
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Pipeline);
+    }
+
+    // heaviest weights first, zero weights contribute nothing
+    std::vector<uint32_t> order(morphed.TargetCount);
+    for (uint32_t i = 0; i < morphed.TargetCount; i++)
+    {
+      order[i] = i;
+    }
+
+    uint32_t activeCount = glm::min(morphed.TargetCount, (uint32_t)MAX_MORPH_ACTIVE_TARGETS);
+    std::partial_sort(order.begin(), order.begin() + activeCount, order.end(),
+      [&morphed](uint32_t a, uint32_t b)
+      {
+        return fabsf(morphed.Weights[a]) > fabsf(morphed.Weights[b]);
+      });
+
+    stMorphConstantsGPU constants = {};
+    constants.VertexCount = morphed.VertexCount;
+
+    for (uint32_t i = 0; i < activeCount && morphed.Weights[order[i]] != 0.0f; i++)
+    {
+      constants.Targets[constants.TargetCount] = order[i];
+      constants.Weights[constants.TargetCount] = morphed.Weights[order[i]];
+      constants.TargetCount++;
+    }
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Layout, 0, 1, &morphed.DescriptorSet, 0, nullptr);
+    vkCmdPushConstants(cmd, Pipeline.Layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(cmd, (morphed.VertexCount + 63) / 64, 1, 1);
+
+    VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = morphed.Output.Buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    barriers.push_back(barrier);
+
+    morphed.Dirty = false;
+  }
+
+  if (!barriers.empty())
+  {
+    // read as vertices, or as the source of the skinning pass
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, (uint32_t)barriers.size(), barriers.data(), 0, nullptr);
+  }
+}
@@ -20,6 +20,7 @@ stPhysicsSystem
       Velocities[i].y += force.y * dt;
       TransformSystem->Positions[i] += Velocities[i] * dt;
       TransformSystem->Tramsforms[i] = glm::translate(TransformSystem->Tramsforms[i], TransformSystem->Positions[i]);
+      TransformSystem->MarkDirty(i);
     }
   }
   // control transforms and entity relates with each other
@@ -0,0 +1,151 @@
+
+// ############################################################################
+// # pipeline cache
+// ############################################################################
+
+#define PIPELINE_CACHE_MAGIC 0x48435050 // "PPCH"
+#define PIPELINE_CACHE_VERSION 1
+
+struct
+stPipelineCacheHeader
+{
+  uint32_t Magic = PIPELINE_CACHE_MAGIC;
+  uint32_t Version = PIPELINE_CACHE_VERSION;
+  uint32_t VendorID = 0;
+  uint32_t DeviceID = 0;
+  uint32_t DriverVersion = 0;
+  uint8_t PipelineCacheUUID[VK_UUID_SIZE] = {};
+  uint64_t DataSize = 0;
+};
+
+// One VkPipelineCache shared by every graphics and compute pipeline. It is
+// seeded from PIPELINE_CACHE_PATH at init and written back at term, so
+// startup and swapchain recreation reuse compiled pipelines. A file from
+// another device, driver or cache layout is ignored, the driver checks
+// the data again on its own.
+namespace pipeline_cache
+{
+
+VkDevice Device = VK_NULL_HANDLE;
+VkPipelineCache Cache = VK_NULL_HANDLE;
+stPipelineCacheHeader Expected = {};
+
+bool
+matches(
+  const stPipelineCacheHeader& header)
+{
+  return header.Magic == Expected.Magic
+    && header.Version == Expected.Version
+    && header.VendorID == Expected.VendorID
+    && header.DeviceID == Expected.DeviceID
+    && header.DriverVersion == Expected.DriverVersion
+    && memcmp(header.PipelineCacheUUID, Expected.PipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+std::vector<uint8_t>
+load(
+  const char* path)
+{
+  std::vector<uint8_t> data;
+
+  FILE* file = fopen(path, "rb");
+  if (!file)
+  {
+    return data;
+  }
+
+  stPipelineCacheHeader header = {};
+  if (fread(&header, sizeof(header), 1, file) == 1 && matches(header))
+  {
+    data.resize((size_t)header.DataSize);
+    if (data.empty() || fread(data.data(), data.size(), 1, file) != 1)
+    {
+      data.clear();
+    }
+  }
+  else
+  {
+    printf("Pipeline cache %s is stale, starting empty\n", path);
+  }
+
+  fclose(file);
+  return data;
+}
+
+void
+save(
+  const char* path)
+{
+  size_t size = 0;
+  VK_CHECK(vkGetPipelineCacheData(Device, Cache, &size, nullptr));
+
+  std::vector<uint8_t> data(size);
+  VK_CHECK(vkGetPipelineCacheData(Device, Cache, &size, data.data()));
+
+  FILE* file = fopen(path, "wb");
+  if (!file)
+  {
+    printf("Error writing %s\n", path);
+    return;
+  }
+
+  stPipelineCacheHeader header = Expected;
+  header.DataSize = size;
+
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(data.data(), 1, size, file);
+  fclose(file);
+}
+
+void
+term()
+{
+  if (Cache == VK_NULL_HANDLE)
+  {
+    return;
+  }
+
+  save(PIPELINE_CACHE_PATH);
+
+  vkDestroyPipelineCache(Device, Cache, nullptr);
+  Cache = VK_NULL_HANDLE;
+}
+
+// call before the first pipeline is built; the deletion queue saves the
+// cache after the pipelines pushed later are gone
+void
+init(
+  const stDevice& device,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device.LogicalDevice;
+
+  VkPhysicalDeviceProperties properties = {};
+  vkGetPhysicalDeviceProperties(device.PhysicalDevice, &properties);
+
+  Expected.VendorID = properties.vendorID;
+  Expected.DeviceID = properties.deviceID;
+  Expected.DriverVersion = properties.driverVersion;
+  memcpy(Expected.PipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+  std::vector<uint8_t> data = load(PIPELINE_CACHE_PATH);
+
+  VkPipelineCacheCreateInfo cacheInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+  cacheInfo.initialDataSize = data.size();
+  cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+  // drivers may still refuse data they wrote themselves, start over then
+  if (vkCreatePipelineCache(Device, &cacheInfo, nullptr, &Cache) != VK_SUCCESS)
+  {
+    cacheInfo.initialDataSize = 0;
+    cacheInfo.pInitialData = nullptr;
+    VK_CHECK(vkCreatePipelineCache(Device, &cacheInfo, nullptr, &Cache));
+  }
+
+  if (deletionQueue)
+  deletionQueue->PushFunction([=]{
+    term();
+  });
+}
+
+}
@@ -0,0 +1,166 @@
+
+// ############################################################################
+// # render queue
+// ############################################################################
+
+// 64 bit draw keys, most significant field first:
+//   opaque, masked: pass 2 | pipeline 10 | texture 12 | mesh 16 | depth 24
+//   blended:        pass 2 | depth 24    | pipeline 10 | texture 12 | mesh 16
+// opaque draws go front to back within their state, blended ones back to
+// front across pipelines
+#define DRAW_KEY_PASS_BITS 2
+#define DRAW_KEY_PIPELINE_BITS 10
+#define DRAW_KEY_TEXTURE_BITS 12
+#define DRAW_KEY_MESH_BITS 16
+#define DRAW_KEY_DEPTH_BITS 24
+
+struct
+stRenderQueueStats
+{
+  uint32_t Draws = 0; // objects
+  uint32_t Culled = 0; // by the CPU culler, before queueing
+  uint32_t DrawCalls = 0; // recorded draw commands, indirect ones count once
+  uint32_t PipelineBinds = 0;
+  uint32_t PipelineBindsSkipped = 0;
+  uint32_t SetBinds = 0;
+  uint32_t SetBindsSkipped = 0;
+  uint32_t VertexBinds = 0;
+  uint32_t VertexBindsSkipped = 0;
+};
+
+struct
+stRenderQueueItem
+{
+  uint64_t Key;
+  uint32_t Object;
+};
+
+// Radix sorted draw keys. Items and Scratch keep their capacity, so sorting
+// no more draws than last time allocates nothing.
+struct
+stRenderQueue
+{
+  void
+  Clear();
+
+  void
+  Push(
+    uint64_t key,
+    uint32_t object);
+
+  void
+  Sort();
+
+  void
+  PrintStats() const;
+
+  std::vector<stRenderQueueItem> Items;
+  std::vector<stRenderQueueItem> Scratch;
+
+  stRenderQueueStats Stats = {}; // of the last frame drawn
+};
+
+uint64_t
+make_draw_key(
+  uint32_t pass,
+  uint32_t pipeline,
+  uint32_t texture,
+  uint32_t mesh,
+  float depth)
+{
+  // non negative floats order like their bits, keep the top ones
+  uint32_t depthBits = 0;
+  if (depth > 0.0f)
+  {
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+  }
+  uint64_t quantized = depthBits >> (32 - DRAW_KEY_DEPTH_BITS);
+
+  uint64_t state =
+    ((uint64_t)(pipeline & ((1u << DRAW_KEY_PIPELINE_BITS) - 1)) << (DRAW_KEY_TEXTURE_BITS + DRAW_KEY_MESH_BITS))
+    | ((uint64_t)(texture & ((1u << DRAW_KEY_TEXTURE_BITS) - 1)) << DRAW_KEY_MESH_BITS)
+    | (uint64_t)(mesh & ((1u << DRAW_KEY_MESH_BITS) - 1));
+
+  uint64_t key = (uint64_t)(pass & ((1u << DRAW_KEY_PASS_BITS) - 1)) << (64 - DRAW_KEY_PASS_BITS);
+
+  if (pass == ALPHA_MODE_BLEND)
+  {
+    uint64_t farFirst = ((1u << DRAW_KEY_DEPTH_BITS) - 1) - quantized;
+    key |= farFirst << (64 - DRAW_KEY_PASS_BITS - DRAW_KEY_DEPTH_BITS);
+    key |= state;
+  }
+  else
+  {
+    key |= state << DRAW_KEY_DEPTH_BITS;
+    key |= quantized;
+  }
+
+  return key;
+}
+
+void
+stRenderQueue::Clear()
+{
+  Items.clear();
+}
+
+void
+stRenderQueue::Push(
+  uint64_t key,
+  uint32_t object)
+{
+  Items.push_back({ key, object });
+}
+
+// least significant byte first, stable, so equal keys keep push order
+void
+stRenderQueue::Sort()
+{
+  size_t count = Items.size();
+  if (count < 2)
+  {
+    return;
+  }
+
+  Scratch.resize(count);
+
+  for (uint32_t shift = 0; shift < 64; shift += 8)
+  {
+    uint32_t offsets[256] = {};
+    for (const stRenderQueueItem& item : Items)
+    {
+      offsets[(item.Key >> shift) & 0xFF]++;
+    }
+
+    // every key has the same byte here, nothing would move
+    if (offsets[(Items[0].Key >> shift) & 0xFF] == count)
+    {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t bucket = offsets[i];
+      offsets[i] = offset;
+      offset += bucket;
+    }
+
+    for (const stRenderQueueItem& item : Items)
+    {
+      Scratch[offsets[(item.Key >> shift) & 0xFF]++] = item;
+    }
+
+    Items.swap(Scratch);
+  }
+}
+
+void
+stRenderQueue::PrintStats() const
+{
+  printf("%u draws in %u calls, %u culled, pipeline binds %u (%u skipped), set binds %u (%u skipped), vertex binds %u (%u skipped)\n",
+    Stats.Draws, Stats.DrawCalls, Stats.Culled,
+    Stats.PipelineBinds, Stats.PipelineBindsSkipped,
+    Stats.SetBinds, Stats.SetBindsSkipped,
+    Stats.VertexBinds, Stats.VertexBindsSkipped);
+}
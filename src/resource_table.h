@@ -0,0 +1,132 @@
+
+// ############################################################################
+// # resource tables
+// ############################################################################
+
+// Index into a stResourceTable plus the generation of the slot when the
+// handle was created. Freeing a slot bumps its generation, so handles kept
+// past an unload resolve to nullptr instead of to whatever reused the slot.
+template<typename T>
+struct
+stHandle
+{
+  uint32_t Index = UINT32_MAX;
+  uint32_t Generation = 0;
+
+  bool
+  operator==(const stHandle& other) const
+  {
+    return Index == other.Index && Generation == other.Generation;
+  }
+
+  bool
+  operator!=(const stHandle& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+// Slots are allocated in pages of PageSize, so the table grows on demand
+// while pointers to live slots stay valid. Freed slots are reused first.
+template<typename T, uint32_t PageSize = 256>
+struct
+stResourceTable
+{
+  stHandle<T>
+  Create()
+  {
+    uint32_t index = 0;
+
+    if (!FreeSlots.empty())
+    {
+      index = FreeSlots.back();
+      FreeSlots.pop_back();
+    }
+    else
+    {
+      index = (uint32_t)Generations.size();
+
+      if (index % PageSize == 0)
+      {
+        Pages.emplace_back(new T[PageSize]);
+      }
+
+      Generations.push_back(1);
+      Alive.push_back(0);
+    }
+
+    Alive[index] = 1;
+    Count++;
+
+    return HandleOf(index);
+  }
+
+  void
+  Free(
+    stHandle<T> handle)
+  {
+    if (!Get(handle))
+    {
+      return;
+    }
+
+    Slot(handle.Index) = T();
+    Alive[handle.Index] = 0;
+    Generations[handle.Index]++;
+    FreeSlots.push_back(handle.Index);
+    Count--;
+    Frees++;
+  }
+
+  T*
+  Get(
+    stHandle<T> handle)
+  {
+    if (handle.Index >= Generations.size()
+      || !Alive[handle.Index]
+      || Generations[handle.Index] != handle.Generation)
+    {
+      return nullptr;
+    }
+
+    return &Slot(handle.Index);
+  }
+
+  T&
+  Slot(
+    uint32_t index)
+  {
+    return Pages[index / PageSize][index % PageSize];
+  }
+
+  stHandle<T>
+  HandleOf(
+    uint32_t index) const
+  {
+    stHandle<T> handle;
+    handle.Index = index;
+    handle.Generation = Generations[index];
+    return handle;
+  }
+
+  bool
+  IsAlive(
+    uint32_t index) const
+  {
+    return index < Alive.size() && Alive[index];
+  }
+
+  // one past the highest slot ever used, for iterating with IsAlive
+  uint32_t
+  Capacity() const
+  {
+    return (uint32_t)Generations.size();
+  }
+
+  std::vector<std::unique_ptr<T[]>> Pages;
+  std::vector<uint32_t> Generations;
+  std::vector<uint8_t> Alive;
+  std::vector<uint32_t> FreeSlots;
+  uint32_t Count = 0;
+  uint32_t Frees = 0; // ever, lets copies of the slots notice an unload cheaply
+};
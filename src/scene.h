@@ -1,56 +1,470 @@
 
+#define SCENE_MAGIC 0x454E4353 // "SCNE"
+#define SCENE_VERSION 1
+
+#define SCENE_NO_ASSET 0xFFFFFFFF
+
 struct
 stScene
 {
-  void
-  Load(stEntitySystem& entitySystem,
-       stTransformSystem& transformSystem)
-  {
-    stEntityBase base = enity::create_entity(entitySystem, transformSystem, glm::vec3(0.0f,0.0f,0.0f), "./data/models/lost-empire/loast-empire.gltf");
-    *base.Entity->Transform.Tramsform = glm::rotate(*base.Entity->Transform.Tramsform, glm::radians(90.0f),glm::vec3(1.0f, 0.0f, 0.0f));
-    Entities.push_back(base);
-  }
-
-  // TODO: unload scene that were closed
-  void
-  Unload()
-  {
-  }
-
+  // .scene file: header, asset table, entity table, one transform per
+  // entity, then a string table of NUL terminated names and paths. The
+  // tables are read in place from a mapped file in a single pass.
   struct
   scene_header
   {
+    uint32_t Magic = SCENE_MAGIC;
+    uint32_t Version = SCENE_VERSION;
     uint32_t EntitiesCount = 0;
+    uint32_t AssetsCount = 0;
+    uint64_t AssetsOffset = 0;
+    uint64_t EntitiesOffset = 0;
+    uint64_t TransformsOffset = 0;
+    uint64_t StringsOffset = 0;
+    uint64_t StringsSize = 0;
+  };
+
+  struct
+  scene_asset
+  {
+    uint32_t PathOffset = 0; // into the string table
+    uint32_t PathLength = 0;
   };
 
+  // meshes are referenced as a range of an asset's primitives, handles
+  // do not survive a restart
   struct
   scene_entity
   {
-    // int64_t Id = -1; -
-    // const char* Name = "entity";
-    // stEntity* Entity = nullptr;
-    // uint8_t Active = false;
-    // name buffer
-    uint32_t NameLength;
-    uint16_t Active;
-    uint16_t Dynamic;
+    uint32_t NameOffset = 0;
+    uint32_t NameLength = 0;
+    uint32_t Asset = SCENE_NO_ASSET;
+    uint32_t MeshFirst = 0;
+    uint32_t MeshCount = 0;
+    uint16_t Active = 0;
+    uint16_t Dynamic = 0;
   };
 
-  // TODO: save current active scene
+  // the scene the engine starts with when there is no saved one
   void
-  Save()
+  CreateDefault(stEntitySystem& entitySystem,
+                stTransformSystem& transformSystem)
+  {
+    const char* assetPath = "./data/models/lost-empire/loast-empire.gltf";
+
+    stEntityBase base = enity::create_entity(entitySystem, transformSystem, glm::vec3(0.0f,0.0f,0.0f), assetPath);
+    *base.Entity->Transform.Tramsform = glm::rotate(*base.Entity->Transform.Tramsform, glm::radians(90.0f),glm::vec3(1.0f, 0.0f, 0.0f));
+    Entities.push_back(base);
+    Assets.push_back(assetPath);
+    mesh::acquire_asset(assetPath);
+  }
+
+  bool
+  Load(stEntitySystem& entitySystem,
+       stTransformSystem& transformSystem,
+       const char* path,
+       stJobSystem* jobs = nullptr)
   {
-    // stFile file = stFileSystem.CreateFile(name, FILE_BINARY);
-    // file.write<scene_header>(scene_header);
-    // file.write<scene_entity>(scene_entity, count);
+    stMappedFile file;
+    if (!sys::MapFile(path, &file))
+    {
+      return false;
+    }
+
+    const scene_header* header = (const scene_header*)file.Data;
+
+    bool valid = file.Size >= sizeof(scene_header)
+      && header->Magic == SCENE_MAGIC
+      && header->Version == SCENE_VERSION
+      && header->AssetsOffset + sizeof(scene_asset) * (uint64_t)header->AssetsCount <= file.Size
+      && header->EntitiesOffset + sizeof(scene_entity) * (uint64_t)header->EntitiesCount <= file.Size
+      && header->TransformsOffset + sizeof(glm::mat4) * (uint64_t)header->EntitiesCount <= file.Size
+      && header->StringsOffset + header->StringsSize <= file.Size;
+
+    if (!valid)
+    {
+      printf("Error loading %s: not a scene of version %d\n", path, SCENE_VERSION);
+      sys::UnmapFile(&file);
+      return false;
+    }
+
+    const scene_asset* assets = (const scene_asset*)(file.Data + header->AssetsOffset);
+    const scene_entity* entities = (const scene_entity*)(file.Data + header->EntitiesOffset);
+    const glm::mat4* transforms = (const glm::mat4*)(file.Data + header->TransformsOffset);
+
+    const char* strings = (const char*)file.Data + header->StringsOffset;
+
+    // in the table and NUL terminated where the length says
+    auto inStrings = [strings, header](uint32_t offset, uint32_t length)
+    {
+      return (uint64_t)offset + length < header->StringsSize
+        && strings[(uint64_t)offset + length] == '\0';
+    };
+
+    std::vector<mesh::stMeshRange> ranges(header->AssetsCount);
+    for (uint32_t i = 0; i < header->AssetsCount; i++)
+    {
+      if (!inStrings(assets[i].PathOffset, assets[i].PathLength))
+      {
+        continue;
+      }
+
+      std::string assetPath(strings + assets[i].PathOffset, assets[i].PathLength);
+      bool gltf = assetPath.size() > 5 && (assetPath.compare(assetPath.size() - 5, 5, ".gltf") == 0 || assetPath.compare(assetPath.size() - 4, 4, ".glb") == 0);
+
+      if (gltf)
+      {
+        int startIndex, meshCount;
+        mesh::load_gltf_mesh(assetPath.c_str(), startIndex, meshCount, jobs);
+      }
+      else
+      {
+        mesh::load_mesh(assetPath.c_str(), jobs);
+      }
+
+      ranges[i] = mesh::get_asset(assetPath.c_str());
+      Assets.push_back(assetPath);
+      mesh::acquire_asset(assetPath.c_str());
+    }
+
+    Entities.reserve(Entities.size() + header->EntitiesCount);
+    entitySystem.Entities.reserve(entitySystem.Entities.size() + header->EntitiesCount);
+    transformSystem.Tramsforms.reserve(transformSystem.Tramsforms.size() + header->EntitiesCount);
+    transformSystem.Positions.reserve(transformSystem.Positions.size() + header->EntitiesCount);
+
+    for (uint32_t i = 0; i < header->EntitiesCount; i++)
+    {
+      const scene_entity& source = entities[i];
+
+      stEntityBase base = enity::create_entity(entitySystem, transformSystem, glm::vec3(0.0f));
+      *base.Entity->Transform.Tramsform = transforms[i];
+      *base.Entity->Transform.Position = glm::vec3(transforms[i][3]);
+      base.Entity->Dynamic = source.Dynamic != 0;
+      base.Active = (uint8_t)source.Active;
+
+      // the mapping goes away, names are copied
+      if (inStrings(source.NameOffset, source.NameLength))
+      {
+        Names.emplace_back(strings + source.NameOffset, source.NameLength);
+        base.Name = Names.back().c_str();
+      }
+
+      if (source.Asset < header->AssetsCount)
+      {
+        const mesh::stMeshRange& range = ranges[source.Asset];
+
+        if (source.MeshFirst == 0 && source.MeshCount == range.Count)
+        {
+          base.Entity->Meshes = range;
+        }
+        else if ((uint64_t)source.MeshFirst + source.MeshCount <= range.Count)
+        {
+          base.Entity->Meshes = { range.First + source.MeshFirst, source.MeshCount, range.Generation };
+        }
+      }
+
+      Entities.push_back(base);
+    }
+
+    sys::UnmapFile(&file);
+
+    Name = path;
+    return true;
   }
 
+  // frees the scene's entities, their transforms and the mesh assets no
+  // other scene uses, stRenderer::RemoveRenderingObjects has to run first
   void
-  CombineMeshes()
+  Unload(stEntitySystem& entitySystem,
+         stTransformSystem& transformSystem)
   {
+    for (stEntityBase& base : Batches)
+    {
+      for (uint32_t i = 0; i < base.Entity->Meshes.Count; i++)
+      {
+        mesh::Meshes.Free(mesh::get_asset_mesh(base.Entity->Meshes, i));
+      }
+      mesh::free_range(base.Entity->Meshes);
+    }
+
+    Entities.insert(Entities.end(), Batches.begin(), Batches.end());
+
+    for (stEntityBase& base : Entities)
+    {
+      transformSystem.Tramsforms.erase(base.Id);
+      transformSystem.Positions.erase(base.Id);
+      transformSystem.TransformCount--;
+      entitySystem.Entities.erase(base.Id);
+    }
+
+    for (const std::string& asset : Assets)
+    {
+      mesh::release_asset(asset.c_str());
+    }
+
+    Entities.clear();
+    Batches.clear();
+    BatchedMeshes.clear();
+    Assets.clear();
+    Names.clear();
+  }
+
+  bool
+  Save(const char* path)
+  {
+    std::string strings;
+    auto addString = [&strings](const char* text, size_t length)
+    {
+      uint32_t offset = (uint32_t)strings.size();
+      strings.append(text, length);
+      strings.push_back('\0');
+      return offset;
+    };
+
+    // primitive slot -> asset and position in it, to store mesh references
+    std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> meshAssets;
+
+    std::vector<scene_asset> assets(Assets.size());
+    for (uint32_t i = 0; i < Assets.size(); i++)
+    {
+      assets[i].PathLength = (uint32_t)Assets[i].size();
+      assets[i].PathOffset = addString(Assets[i].c_str(), Assets[i].size());
+
+      mesh::stMeshRange range = mesh::get_asset(Assets[i].c_str());
+      for (uint32_t m = 0; m < range.Count; m++)
+      {
+        meshAssets.insert({ mesh::get_asset_mesh(range, m).Index, { i, m } });
+      }
+    }
+
+    std::vector<scene_entity> entities(Entities.size());
+    std::vector<glm::mat4> transforms(Entities.size());
+
+    for (size_t i = 0; i < Entities.size(); i++)
+    {
+      const stEntityBase& base = Entities[i];
+      scene_entity& entity = entities[i];
+
+      size_t nameLength = base.Name ? strlen(base.Name) : 0;
+      entity.NameLength = (uint32_t)nameLength;
+      entity.NameOffset = addString(base.Name ? base.Name : "", nameLength);
+      entity.Active = base.Active;
+      entity.Dynamic = base.Entity->Dynamic;
+      transforms[i] = *base.Entity->Transform.Tramsform;
+
+      // batched entities are saved with their source meshes
+      auto batched = BatchedMeshes.find(base.Id);
+      const mesh::stMeshRange& meshes = batched != BatchedMeshes.end() ? batched->second : base.Entity->Meshes;
+      if (meshes.Count > 0)
+      {
+        // stored as a run of one asset's primitives, in the asset's order
+        auto it = meshAssets.find(mesh::get_asset_mesh(meshes, 0).Index);
+        bool contiguous = it != meshAssets.end()
+          && it->second.second + meshes.Count <= mesh::get_asset(Assets[it->second.first].c_str()).Count;
+
+        for (uint32_t m = 1; contiguous && m < meshes.Count; m++)
+        {
+          mesh::stMeshRange asset = mesh::get_asset(Assets[it->second.first].c_str());
+          contiguous = mesh::get_asset_mesh(meshes, m) == mesh::get_asset_mesh(asset, it->second.second + m);
+        }
+
+        if (contiguous)
+        {
+          entity.Asset = it->second.first;
+          entity.MeshFirst = it->second.second;
+          entity.MeshCount = meshes.Count;
+        }
+        else
+        {
+          printf("Warning: entity %s references meshes outside the scene's assets\n", base.Name);
+        }
+      }
+    }
+
+    scene_header header = {};
+    header.EntitiesCount = (uint32_t)entities.size();
+    header.AssetsCount = (uint32_t)assets.size();
+    header.AssetsOffset = sizeof(scene_header);
+    header.EntitiesOffset = header.AssetsOffset + sizeof(scene_asset) * assets.size();
+    header.TransformsOffset = (header.EntitiesOffset + sizeof(scene_entity) * entities.size() + 15) & ~15ull;
+    header.StringsOffset = header.TransformsOffset + sizeof(glm::mat4) * transforms.size();
+    header.StringsSize = strings.size();
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+      printf("Error writing %s\n", path);
+      return false;
+    }
+
+    uint8_t padding[16] = {};
+    uint64_t entitiesEnd = header.EntitiesOffset + sizeof(scene_entity) * entities.size();
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(assets.data(), sizeof(scene_asset), assets.size(), file);
+    fwrite(entities.data(), sizeof(scene_entity), entities.size(), file);
+    fwrite(padding, 1, header.TransformsOffset - entitiesEnd, file);
+    fwrite(transforms.data(), sizeof(glm::mat4), transforms.size(), file);
+    fwrite(strings.data(), 1, strings.size(), file);
+    fclose(file);
+
+    return true;
+  }
+
+  // Static batching: triangles of entities that are not Dynamic are
+  // pre-transformed and merged per STATIC_BATCH_CELL_SIZE cell and per
+  // material into one mesh each. A cell becomes one entity placed at its
+  // center, vertices stay relative to it so bounds stay tight. The source
+  // entities keep their transforms but no longer draw their meshes.
+  // Call before stRenderer::AddRenderingObjectsFromEntities.
+  void
+  CombineMeshes(stEntitySystem& entitySystem,
+                stTransformSystem& transformSystem)
+  {
+    struct stBatch
+    {
+      glm::ivec3 Cell;
+      mesh::stMeshHandle Handle;
+    };
+
+    // 16 bits per cell axis, a million units around the origin at the
+    // default cell size; the material id takes the low 16 bits
+    auto cellKey = [](const glm::ivec3& cell)
+    {
+      return ((uint64_t)(cell.x & 0xFFFF) << 48) | ((uint64_t)(cell.y & 0xFFFF) << 32) | ((uint64_t)(cell.z & 0xFFFF) << 16);
+    };
+
+    std::vector<stBatch> batches;
+    std::unordered_map<uint64_t, uint32_t> batchIndices; // cell + material -> batches
+    std::unordered_map<std::string, uint32_t> materialIds; // surface and texture -> id
+
+    std::vector<uint32_t> remap;
+    std::vector<uint32_t> remapBatch;
+
+    for (stEntityBase& base : Entities)
+    {
+      stEntity* entity = base.Entity;
+      if (entity->Dynamic || entity->Meshes.Count == 0)
+      {
+        continue;
+      }
+
+      // deformed meshes are animated per instance, they stay separate
+      bool combinable = true;
+      for (uint32_t m = 0; m < entity->Meshes.Count && combinable; m++)
+      {
+        stMesh* source = mesh::get_mesh(mesh::get_asset_mesh(entity->Meshes, m));
+        combinable = source && source->MorphTargetCount == 0 && source->SkinVertices.empty();
+      }
+
+      if (!combinable)
+      {
+        continue;
+      }
+
+      for (uint32_t m = 0; m < entity->Meshes.Count; m++)
+      {
+        const stMesh& source = *mesh::get_mesh(mesh::get_asset_mesh(entity->Meshes, m));
+
+        glm::mat4 world = *entity->Transform.Tramsform * source.RootMatrix;
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+        bool flip = glm::determinant(glm::mat3(world)) < 0.0f;
+
+        std::string material = source.Surface.Name + "|" + source.TexturePath;
+        uint32_t materialId = materialIds.insert({ material, (uint32_t)materialIds.size() }).first->second;
+        assert(materialId <= 0xFFFF);
+
+        remap.assign(source.Vertices.size(), 0);
+        remapBatch.assign(source.Vertices.size(), UINT32_MAX);
+
+        for (size_t t = 0; t + 2 < source.Indices.size(); t += 3)
+        {
+          glm::vec3 corners[3];
+          for (int c = 0; c < 3; c++)
+          {
+            corners[c] = glm::vec3(world * glm::vec4(source.Vertices[source.Indices[t + c]].Position, 1.0f));
+          }
+
+          glm::ivec3 cell = glm::ivec3(glm::floor((corners[0] + corners[1] + corners[2]) / (3.0f * STATIC_BATCH_CELL_SIZE)));
+
+          uint64_t key = cellKey(cell) | materialId;
+
+          auto found = batchIndices.find(key);
+          if (found == batchIndices.end())
+          {
+            stBatch batch = { cell, mesh::Meshes.Create() };
+
+            stMesh* combined = mesh::get_mesh(batch.Handle);
+            combined->TexturePath = source.TexturePath;
+            combined->Surface = source.Surface;
+
+            found = batchIndices.insert({ key, (uint32_t)batches.size() }).first;
+            batches.push_back(batch);
+          }
+
+          uint32_t batchIndex = found->second;
+          stMesh* combined = mesh::get_mesh(batches[batchIndex].Handle);
+          glm::vec3 center = (glm::vec3(batches[batchIndex].Cell) + 0.5f) * STATIC_BATCH_CELL_SIZE;
+
+          for (int c = 0; c < 3; c++)
+          {
+            uint32_t index = source.Indices[t + (flip ? 2 - c : c)];
+
+            // vertices shared with triangles of another cell get copied
+            if (remapBatch[index] != batchIndex)
+            {
+              stVertex vertex = source.Vertices[index];
+              vertex.Position = glm::vec3(world * glm::vec4(vertex.Position, 1.0f)) - center;
+              vertex.Normal = glm::normalize(normalMatrix * vertex.Normal);
+
+              remap[index] = (uint32_t)combined->Vertices.size();
+              remapBatch[index] = batchIndex;
+              combined->Vertices.push_back(vertex);
+            }
+
+            combined->Indices.push_back(remap[index]);
+          }
+        }
+      }
+
+      BatchedMeshes[base.Id] = entity->Meshes;
+      entity->Meshes = {};
+    }
+
+    // one entity per cell, holding a mesh per material
+    std::unordered_map<uint64_t, uint32_t> cellIndices;
+    std::vector<std::pair<glm::ivec3, std::vector<mesh::stMeshHandle>>> cells;
+
+    for (const stBatch& batch : batches)
+    {
+      mesh::compute_bounds(*mesh::get_mesh(batch.Handle));
+
+      uint64_t key = cellKey(batch.Cell);
+
+      auto found = cellIndices.find(key);
+      if (found == cellIndices.end())
+      {
+        found = cellIndices.insert({ key, (uint32_t)cells.size() }).first;
+        cells.push_back({ batch.Cell, {} });
+      }
+      cells[found->second].second.push_back(batch.Handle);
+    }
+
+    for (const auto& cell : cells)
+    {
+      stEntityBase base = enity::create_entity(entitySystem, transformSystem, (glm::vec3(cell.first) + 0.5f) * STATIC_BATCH_CELL_SIZE);
+      base.Name = "static batch";
+      base.Active = true;
+      base.Entity->Meshes = mesh::make_range(cell.second);
+      Batches.push_back(base);
+    }
   }
 
   std::vector<stEntityBase> Entities;
+  std::vector<stEntityBase> Batches; // static batch cells built by CombineMeshes
+  std::unordered_map<int64_t, mesh::stMeshRange> BatchedMeshes; // entity id -> meshes folded into Batches
+  std::vector<std::string> Assets;
+  std::deque<std::string> Names; // entity names of loaded scenes, stay put while more are added
 
   std::string Name;
-};
\ No newline at end of file
+};
@@ -0,0 +1,271 @@
+
+// ############################################################################
+// # skinning
+// ############################################################################
+
+struct
+stSkinningConstantsGPU
+{
+  uint32_t VertexCount = 0;
+  uint32_t JointOffset = 0;
+};
+
+// Skins vertices on the GPU once per frame. Joint matrices of all animators
+// go to one persistently mapped buffer with a region per swapchain image,
+// every skinned mesh reads its animator's range from it and writes an output
+// vertex buffer that is drawn instead of the source one.
+struct
+stSkinningPass
+{
+  struct
+  stSkinnedMesh
+  {
+    mesh::stMeshHandle Mesh;
+    stBuffer SkinVertices = {};
+    stBuffer Output = {};
+    VkDescriptorSet DescriptorSet = VK_NULL_HANDLE;
+    uint32_t VertexCount = 0;
+    uint32_t Animator = 0;
+  };
+
+  void
+  Init(
+    const stDevice& device,
+    VkCommandPool commandPool,
+    stDeletionQueue* deletionQueue);
+
+  // sourceVertices is the base or the morphed vertex buffer and needs
+  // storage buffer usage, the returned buffer is drawn in its place
+  stBuffer
+  Add(
+    mesh::stMeshHandle handle,
+    const stMesh& mesh,
+    const stBuffer& sourceVertices,
+    uint32_t animator);
+
+  // releases the buffers of the mesh through the deferred buckets, its
+  // descriptor set stays allocated until the pool goes
+  void
+  Remove(
+    mesh::stMeshHandle handle);
+
+  // uploads the joint matrices and records the dispatches, outside of a render pass
+  void
+  Record(
+    VkCommandBuffer cmd,
+    uint32_t imageIndex,
+    const stAnimationSystem& animation);
+
+  stDevice Device = {};
+  VkCommandPool CommandPool = VK_NULL_HANDLE;
+  stDeletionQueue* DeletionQueue = nullptr;
+
+  stComputePipeline Pipeline = {};
+
+  VkDescriptorPool DescriptorPool = VK_NULL_HANDLE;
+  uint32_t DescriptorPoolFill = 0;
+
+  stBuffer Joints = {};
+  glm::mat4* MappedJoints = nullptr;
+
+  std::vector<stSkinnedMesh> Meshes;
+};
+
+void
+stSkinningPass::Init(
+  const stDevice& device,
+  VkCommandPool commandPool,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device;
+  CommandPool = commandPool;
+  DeletionQueue = deletionQueue;
+
+  // source vertices, skin vertices, joint matrices, output vertices
+  VkDescriptorSetLayoutBinding bindings[4] = {};
+  for (uint32_t i = 0; i < ArrayCount(bindings); i++)
+  {
+    bindings[i].binding = i;
+    bindings[i].descriptorCount = 1;
+    bindings[i].descriptorType = i == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  Pipeline = init::create_compute_pipeline(
+    Device,
+    "./data/shaders/skinning.comp.spv",
+    bindings,
+    ArrayCount(bindings),
+    sizeof(stSkinningConstantsGPU),
+    DeletionQueue
+  );
+
+  init::create_buffer(
+    Device,
+    sizeof(glm::mat4) * MAX_SKINNING_JOINTS * MAX_SWAPCHAIN_IMAGE_COUNT,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    Joints,
+    DeletionQueue
+  );
+
+  // host visible blocks stay mapped
+  MappedJoints = (glm::mat4*)Joints.Allocation.Mapped;
+}
+
+stBuffer
+stSkinningPass::Add(
+  mesh::stMeshHandle handle,
+  const stMesh& mesh,
+  const stBuffer& sourceVertices,
+  uint32_t animator)
+{
+  stSkinnedMesh skinned = {};
+  skinned.Mesh = handle;
+  skinned.VertexCount = (uint32_t)mesh.Vertices.size();
+  skinned.Animator = animator;
+
+  VkDeviceSize vertexBytes = sizeof(stVertex) * mesh.Vertices.size();
+  VkDeviceSize skinBytes = sizeof(stSkinVertex) * mesh.SkinVertices.size();
+
+  skinned.SkinVertices = init::create_device_buffer(
+    Device,
+    CommandPool,
+    mesh.SkinVertices.data(),
+    skinBytes,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+  );
+
+  init::create_buffer(
+    Device,
+    vertexBytes,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    skinned.Output,
+    nullptr
+  );
+
+  if (DescriptorPool == VK_NULL_HANDLE || DescriptorPoolFill == SKINNING_DESCRIPTOR_POOL_SIZE)
+  {
+    VkDescriptorPoolSize poolSizes[] =
+    {
+      { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, SKINNING_DESCRIPTOR_POOL_SIZE * 3 },
+      { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, SKINNING_DESCRIPTOR_POOL_SIZE }
+    };
+
+    DescriptorPool = init::create_descriptor_pools(Device, poolSizes, ArrayCount(poolSizes), SKINNING_DESCRIPTOR_POOL_SIZE, DeletionQueue);
+    DescriptorPoolFill = 0;
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+  allocInfo.descriptorPool = DescriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &Pipeline.SetLayout;
+
+  VK_CHECK(vkAllocateDescriptorSets(Device.LogicalDevice, &allocInfo, &skinned.DescriptorSet));
+  DescriptorPoolFill++;
+
+  VkDescriptorBufferInfo bufferInfos[4] =
+  {
+    { sourceVertices.Buffer, 0, vertexBytes },
+    { skinned.SkinVertices.Buffer, 0, skinBytes },
+    { Joints.Buffer, 0, sizeof(glm::mat4) * MAX_SKINNING_JOINTS },
+    { skinned.Output.Buffer, 0, vertexBytes }
+  };
+
+  VkWriteDescriptorSet writes[4];
+  for (uint32_t i = 0; i < ArrayCount(writes); i++)
+  {
+    VkDescriptorType type = i == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i] = init::write_descriptor_buffer(type, skinned.DescriptorSet, &bufferInfos[i], i);
+  }
+
+  vkUpdateDescriptorSets(Device.LogicalDevice, ArrayCount(writes), writes, 0, nullptr);
+
+  Meshes.push_back(skinned);
+
+  return skinned.Output;
+}
+
+void
+stSkinningPass::Remove(
+  mesh::stMeshHandle handle)
+{
+  for (size_t i = 0; i < Meshes.size(); i++)
+  {
+    if (Meshes[i].Mesh == handle)
+    {
+      deferred::buffer(Meshes[i].SkinVertices);
+      deferred::buffer(Meshes[i].Output);
+
+      Meshes[i] = Meshes.back();
+      Meshes.pop_back();
+      return;
+    }
+  }
+}
+
+void
+stSkinningPass::Record(
+  VkCommandBuffer cmd,
+  uint32_t imageIndex,
+  const stAnimationSystem& animation)
+{
+  if (Meshes.empty())
+  {
+    return;
+  }
+
+  // CreateAnimator keeps the total within the region
+  uint32_t jointCount = (uint32_t)animation.JointMatrices.size();
+  assert(jointCount <= MAX_SKINNING_JOINTS);
+
+  // this image's region is free, its previous submission was waited on
+  uint32_t region = imageIndex * MAX_SKINNING_JOINTS;
+  memcpy(MappedJoints + region, animation.JointMatrices.data(), jointCount * sizeof(glm::mat4));
+
+  uint32_t dynamicOffset = region * (uint32_t)sizeof(glm::mat4);
+
+  std::vector<VkBufferMemoryBarrier> barriers;
+
+  for (stSkinnedMesh& skinned : Meshes)
+  {
+    if (!mesh::get_mesh(skinned.Mesh) || skinned.Animator >= animation.Animators.size())
+    {
+      continue;
+    }
+
+    const stAnimator& animator = animation.Animators[skinned.Animator];
+
+    if (barriers.empty())
+    {
+      // the previous frame may still be fetching the output vertices, and
+      // the morph pass may just have written the source ones
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Pipeline);
+    }
+
+    stSkinningConstantsGPU constants = {};
+    constants.VertexCount = skinned.VertexCount;
+    constants.JointOffset = animator.JointOffset;
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline.Layout, 0, 1, &skinned.DescriptorSet, 1, &dynamicOffset);
+    vkCmdPushConstants(cmd, Pipeline.Layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(cmd, (skinned.VertexCount + 63) / 64, 1, 1);
+
+    VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = skinned.Output.Buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    barriers.push_back(barrier);
+  }
+
+  if (!barriers.empty())
+  {
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, (uint32_t)barriers.size(), barriers.data(), 0, nullptr);
+  }
+}
@@ -0,0 +1,809 @@
+
+// ############################################################################
+// # cooked mip chains
+// ############################################################################
+
+namespace
+texture
+{
+
+#define MIP_CHAIN_MAGIC 0x5350494D // "MIPS"
+#define MIP_CHAIN_VERSION 2
+
+// .mips file: header followed by every level (RGBA8 sRGB), finest first,
+// so any tail of the chain [level .. MipCount - 1] is one contiguous read.
+// The source size and write time are kept to recook a changed image.
+struct
+stMipChainHeader
+{
+  uint32_t Magic = MIP_CHAIN_MAGIC;
+  uint32_t Version = MIP_CHAIN_VERSION;
+  uint32_t Width = 0;
+  uint32_t Height = 0;
+  uint32_t MipCount = 0;
+  uint32_t Reserved = 0;
+  uint64_t SourceSize = 0;
+  uint64_t SourceTime = 0;
+  uint64_t Offsets[MAX_TEXTURE_MIPS] = {};
+  uint64_t Sizes[MAX_TEXTURE_MIPS] = {};
+};
+
+uint32_t
+mip_dimension(
+  uint32_t size,
+  uint32_t level)
+{
+  return utils::Max(size >> level, 1u);
+}
+
+uint64_t
+mip_chain_size(
+  const stMipChainHeader& header,
+  uint32_t firstLevel)
+{
+  uint64_t size = 0;
+  for (uint32_t i = firstLevel; i < header.MipCount; i++)
+  {
+    size += header.Sizes[i];
+  }
+  return size;
+}
+
+float
+srgb_to_linear(
+  float c)
+{
+  return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+uint8_t
+linear_to_srgb(
+  float c)
+{
+  c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+  return (uint8_t)glm::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f);
+}
+
+bool
+cook_mip_chain(
+  const char* path,
+  const char* cookedPath)
+{
+  int texWidth, texHeight, texChannels;
+  stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+  if (!pixels)
+  {
+    printf("Error loading %s: file not found\n", path);
+    return false;
+  }
+
+  stMipChainHeader header = {};
+  utils::FileStamp(path, &header.SourceSize, &header.SourceTime);
+  header.Width = (uint32_t)texWidth;
+  header.Height = (uint32_t)texHeight;
+  header.MipCount = static_cast<uint32_t>(std::floor(std::log2(utils::Max(texWidth, texHeight)))) + 1;
+  header.MipCount = glm::min(header.MipCount, (uint32_t)MAX_TEXTURE_MIPS);
+
+  float toLinear[256];
+  for (int i = 0; i < 256; i++)
+  {
+    toLinear[i] = srgb_to_linear(i / 255.0f);
+  }
+
+  std::vector<std::vector<uint8_t>> levels(header.MipCount);
+  levels[0].assign(pixels, pixels + texWidth * texHeight * 4);
+  stbi_image_free(pixels);
+
+  uint64_t offset = sizeof(stMipChainHeader);
+
+  for (uint32_t level = 0; level < header.MipCount; level++)
+  {
+    uint32_t width = mip_dimension(header.Width, level);
+    uint32_t height = mip_dimension(header.Height, level);
+
+    if (level > 0)
+    {
+      // 2x2 box filter in linear space, alpha is filtered as is
+      uint32_t srcWidth = mip_dimension(header.Width, level - 1);
+      uint32_t srcHeight = mip_dimension(header.Height, level - 1);
+      const uint8_t* src = levels[level - 1].data();
+
+      levels[level].resize(width * height * 4);
+      uint8_t* dst = levels[level].data();
+
+      for (uint32_t y = 0; y < height; y++)
+      {
+        uint32_t y0 = glm::min(y * 2, srcHeight - 1);
+        uint32_t y1 = glm::min(y * 2 + 1, srcHeight - 1);
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+          uint32_t x0 = glm::min(x * 2, srcWidth - 1);
+          uint32_t x1 = glm::min(x * 2 + 1, srcWidth - 1);
+
+          const uint8_t* taps[4] =
+          {
+            &src[(y0 * srcWidth + x0) * 4],
+            &src[(y0 * srcWidth + x1) * 4],
+            &src[(y1 * srcWidth + x0) * 4],
+            &src[(y1 * srcWidth + x1) * 4]
+          };
+
+          for (uint32_t c = 0; c < 3; c++)
+          {
+            float sum = toLinear[taps[0][c]] + toLinear[taps[1][c]] + toLinear[taps[2][c]] + toLinear[taps[3][c]];
+            dst[(y * width + x) * 4 + c] = linear_to_srgb(sum * 0.25f);
+          }
+
+          uint32_t alpha = taps[0][3] + taps[1][3] + taps[2][3] + taps[3][3];
+          dst[(y * width + x) * 4 + 3] = (uint8_t)((alpha + 2) / 4);
+        }
+      }
+    }
+
+    header.Offsets[level] = offset;
+    header.Sizes[level] = (uint64_t)width * height * 4;
+    offset += header.Sizes[level];
+  }
+
+  FILE* file = fopen(cookedPath, "wb");
+  if (!file)
+  {
+    printf("Error writing %s\n", cookedPath);
+    return false;
+  }
+
+  fwrite(&header, sizeof(header), 1, file);
+  for (uint32_t level = 0; level < header.MipCount; level++)
+  {
+    fwrite(levels[level].data(), levels[level].size(), 1, file);
+  }
+  fclose(file);
+
+  return true;
+}
+
+// false for a missing, foreign or outdated .mips file; a source that is
+// gone keeps the cooked chain usable
+bool
+read_mip_chain_header(
+  const char* path,
+  const char* cookedPath,
+  stMipChainHeader& header)
+{
+  FILE* file = fopen(cookedPath, "rb");
+  if (!file)
+  {
+    return false;
+  }
+
+  size_t read = fread(&header, sizeof(header), 1, file);
+  fclose(file);
+
+  if (read != 1
+    || header.Magic != MIP_CHAIN_MAGIC
+    || header.Version != MIP_CHAIN_VERSION
+    || header.MipCount == 0
+    || header.MipCount > MAX_TEXTURE_MIPS)
+  {
+    return false;
+  }
+
+  uint64_t sourceSize, sourceTime;
+  if (!utils::FileStamp(path, &sourceSize, &sourceTime))
+  {
+    return true;
+  }
+
+  return header.SourceSize == sourceSize && header.SourceTime == sourceTime;
+}
+
+// reads levels [firstLevel .. lastLevel] into dst in file order
+bool
+read_mip_levels(
+  const char* cookedPath,
+  const stMipChainHeader& header,
+  uint32_t firstLevel,
+  uint32_t lastLevel,
+  void* dst)
+{
+  FILE* file = fopen(cookedPath, "rb");
+  if (!file)
+  {
+    return false;
+  }
+
+  uint64_t size = header.Offsets[lastLevel] + header.Sizes[lastLevel] - header.Offsets[firstLevel];
+
+  // chains past 2 GB need the 64 bit seek
+  if (_fseeki64(file, (__int64)header.Offsets[firstLevel], SEEK_SET) != 0)
+  {
+    fclose(file);
+    return false;
+  }
+
+  size_t read = fread(dst, (size_t)size, 1, file);
+  fclose(file);
+
+  return read == 1;
+}
+
+}
+
+// ############################################################################
+// # texture streamer
+// ############################################################################
+
+// Streamed textures keep only a tail of their mip chain in VRAM. Each frame
+// the renderer reports how many pixels a texture covers, the streamer turns
+// that into a requested mip, and then grows or shrinks the resident chain
+// under TEXTURE_STREAMING_BUDGET. New finer levels arrive one per upload and
+// are exposed through the sampler minLod, so sampling never touches a level
+// that has not been uploaded yet.
+struct
+stTextureStreamer
+{
+  struct
+  stStreamedTexture
+  {
+    stTexture* Texture = nullptr;
+    std::string CookedPath;
+    texture::stMipChainHeader Header = {};
+    uint32_t InitialMip = 0;     // coarse tail loaded up front
+    uint32_t ImageBaseMip = 0;   // source level stored in mip 0 of the image
+    uint32_t ResidentMip = 0;    // finest source level uploaded
+    uint32_t RequestedMip = 0;   // finest source level requested this frame
+    uint64_t LastRequestFrame = 0;
+    VkDeviceSize ImageBytes = 0;
+    uint32_t DirtyImages = 0;    // swapchain images with a stale descriptor
+  };
+
+  struct
+  stPendingRelease
+  {
+    stImage Image = {};
+    uint32_t Streamed = 0;
+  };
+
+  void
+  Init(
+    const stDevice& device);
+
+  // nullptr when the image can neither be read nor cooked
+  stTexture*
+  Load(
+    const char* path);
+
+  void
+  BeginFrame();
+
+  void
+  Request(
+    uint32_t textureIndex,
+    float coveragePixels);
+
+  void
+  Update(
+    uint32_t imageCount);
+
+  void
+  UpdateDescriptors(
+    VkDescriptorSet* textureSets,
+    uint32_t imageIndex);
+
+  void
+  Term();
+
+  uint32_t
+  WantedMip(
+    const stStreamedTexture& streamed) const;
+
+  void
+  Reallocate(
+    VkCommandBuffer cmd,
+    uint32_t streamedIndex,
+    uint32_t newBaseMip,
+    uint32_t imageCount);
+
+  bool
+  Evict(
+    VkCommandBuffer cmd,
+    VkDeviceSize required,
+    uint32_t exclude,
+    uint32_t imageCount);
+
+  void
+  DestroyImage(
+    stImage& image);
+
+  stDevice Device = {};
+
+  VkSampler LodSamplers[MAX_TEXTURE_MIPS] = {};
+
+  std::vector<stStreamedTexture> Textures;
+  std::vector<int32_t> StreamedIndices; // init::Textures index -> Textures index
+  std::vector<stPendingRelease> PendingReleases;
+
+  VkDeviceSize Budget = TEXTURE_STREAMING_BUDGET;
+  VkDeviceSize TotalBytes = 0;
+  uint64_t FrameCounter = 0;
+};
+
+void
+stTextureStreamer::Init(
+  const stDevice& device)
+{
+  Device = device;
+
+  for (uint32_t i = 0; i < MAX_TEXTURE_MIPS; i++)
+  {
+    LodSamplers[i] = init::get_sampler(
+      Device,
+      VK_FILTER_LINEAR,
+      VK_SAMPLER_ADDRESS_MODE_REPEAT,
+      VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+      (float)i
+    );
+  }
+}
+
+stTexture*
+stTextureStreamer::Load(
+  const char* path)
+{
+  stStreamedTexture streamed = {};
+  streamed.CookedPath = std::string(path) + ".mips";
+
+  if (!texture::read_mip_chain_header(path, streamed.CookedPath.c_str(), streamed.Header))
+  {
+    bool cooked = texture::cook_mip_chain(path, streamed.CookedPath.c_str())
+      && texture::read_mip_chain_header(path, streamed.CookedPath.c_str(), streamed.Header);
+    if (!cooked)
+    {
+      printf("Error loading %s: no mip chain\n", path);
+      return nullptr;
+    }
+  }
+
+  const texture::stMipChainHeader& header = streamed.Header;
+
+  uint32_t initialMip = 0;
+  while (initialMip + 1 < header.MipCount
+    && utils::Max(texture::mip_dimension(header.Width, initialMip), texture::mip_dimension(header.Height, initialMip)) > TEXTURE_STREAMING_INITIAL_SIZE)
+  {
+    initialMip++;
+  }
+
+  uint32_t levels = header.MipCount - initialMip;
+  VkDeviceSize tailSize = texture::mip_chain_size(header, initialMip);
+
+  VkBuffer staging = VK_NULL_HANDLE;
+  VkDeviceSize stagingOffset = 0;
+  uint8_t* stagingData = upload::stage(tailSize, 16, &staging, &stagingOffset);
+
+  // the staged bytes stay unused, the ring reclaims them with the batch
+  if (!texture::read_mip_levels(streamed.CookedPath.c_str(), header, initialMip, header.MipCount - 1, stagingData))
+  {
+    printf("Error reading %s\n", streamed.CookedPath.c_str());
+    return nullptr;
+  }
+
+  streamed.Texture = init::register_texture(path);
+  streamed.InitialMip = initialMip;
+  streamed.ImageBaseMip = initialMip;
+  streamed.ResidentMip = initialMip;
+  streamed.RequestedMip = initialMip;
+  streamed.ImageBytes = tailSize;
+
+  stTexture* texture = streamed.Texture;
+  texture->MipLevels = levels;
+  texture->Image = init::create_image(
+    Device,
+    texture::mip_dimension(header.Width, initialMip),
+    texture::mip_dimension(header.Height, initialMip),
+    levels,
+    VK_SAMPLE_COUNT_1_BIT,
+    VK_FORMAT_R8G8B8A8_SRGB,
+    VK_IMAGE_TILING_OPTIMAL,
+    VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+    VK_IMAGE_USAGE_SAMPLED_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  );
+  init::create_image_view(Device, texture->Image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, levels);
+  texture->Sampler = LodSamplers[0];
+
+  VkCommandBuffer cmd = upload::cmd();
+
+  init::cmd_image_barrier(cmd, texture->Image.Src, 0, levels,
+    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    0, VK_ACCESS_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  std::vector<VkBufferImageCopy> regions(levels);
+  for (uint32_t i = 0; i < levels; i++)
+  {
+    uint32_t level = initialMip + i;
+
+    VkBufferImageCopy& region = regions[i];
+    region = {};
+    region.bufferOffset = stagingOffset + header.Offsets[level] - header.Offsets[initialMip];
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = i;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { texture::mip_dimension(header.Width, level), texture::mip_dimension(header.Height, level), 1 };
+  }
+
+  vkCmdCopyBufferToImage(cmd, staging, texture->Image.Src, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levels, regions.data());
+
+  upload::release_image(texture->Image.Src, 0, levels,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+  if (StreamedIndices.size() <= texture->DescriptorIndex)
+  {
+    StreamedIndices.resize(texture->DescriptorIndex + 1, -1);
+  }
+  StreamedIndices[texture->DescriptorIndex] = (int32_t)Textures.size();
+
+  TotalBytes += streamed.ImageBytes;
+  Textures.push_back(streamed);
+
+  return texture;
+}
+
+void
+stTextureStreamer::BeginFrame()
+{
+  FrameCounter++;
+}
+
+void
+stTextureStreamer::Request(
+  uint32_t textureIndex,
+  float coveragePixels)
+{
+  if (textureIndex >= StreamedIndices.size() || StreamedIndices[textureIndex] < 0)
+  {
+    return;
+  }
+
+  stStreamedTexture& streamed = Textures[StreamedIndices[textureIndex]];
+  const texture::stMipChainHeader& header = streamed.Header;
+
+  // one texel per covered pixel along the larger axis
+  float texels = (float)utils::Max(header.Width, header.Height);
+  float ratio = texels / glm::max(coveragePixels, 1.0f);
+  uint32_t mip = ratio <= 1.0f ? 0 : (uint32_t)std::floor(std::log2(ratio));
+  mip = glm::min(mip, header.MipCount - 1);
+
+  if (streamed.LastRequestFrame != FrameCounter)
+  {
+    streamed.LastRequestFrame = FrameCounter;
+    streamed.RequestedMip = header.MipCount - 1;
+  }
+
+  streamed.RequestedMip = glm::min(streamed.RequestedMip, mip);
+}
+
+uint32_t
+stTextureStreamer::WantedMip(
+  const stStreamedTexture& streamed) const
+{
+  if (streamed.LastRequestFrame + TEXTURE_STREAMING_EVICT_FRAMES < FrameCounter)
+  {
+    return streamed.InitialMip;
+  }
+
+  return glm::min(streamed.RequestedMip, streamed.InitialMip);
+}
+
+void
+stTextureStreamer::DestroyImage(
+  stImage& image)
+{
+  vkDestroyImageView(Device.LogicalDevice, image.View, nullptr);
+  vkDestroyImage(Device.LogicalDevice, image.Src, nullptr);
+  memory::release(image.Allocation);
+  image = {};
+}
+
+void
+stTextureStreamer::Reallocate(
+  VkCommandBuffer cmd,
+  uint32_t streamedIndex,
+  uint32_t newBaseMip,
+  uint32_t imageCount)
+{
+  stStreamedTexture& streamed = Textures[streamedIndex];
+  const texture::stMipChainHeader& header = streamed.Header;
+  stTexture* texture = streamed.Texture;
+
+  stImage oldImage = texture->Image;
+  uint32_t oldBaseMip = streamed.ImageBaseMip;
+  uint32_t levels = header.MipCount - newBaseMip;
+  uint32_t firstCopied = utils::Max(streamed.ResidentMip, newBaseMip);
+  uint32_t copiedCount = header.MipCount - firstCopied;
+
+  stImage image = init::create_image(
+    Device,
+    texture::mip_dimension(header.Width, newBaseMip),
+    texture::mip_dimension(header.Height, newBaseMip),
+    levels,
+    VK_SAMPLE_COUNT_1_BIT,
+    VK_FORMAT_R8G8B8A8_SRGB,
+    VK_IMAGE_TILING_OPTIMAL,
+    VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+    VK_IMAGE_USAGE_SAMPLED_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+  );
+  init::create_image_view(Device, image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, levels);
+
+  init::cmd_image_barrier(cmd, image.Src, 0, levels,
+    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    0, VK_ACCESS_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  init::cmd_image_barrier(cmd, oldImage.Src, firstCopied - oldBaseMip, copiedCount,
+    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  std::vector<VkImageCopy> regions(copiedCount);
+  for (uint32_t i = 0; i < copiedCount; i++)
+  {
+    uint32_t level = firstCopied + i;
+
+    VkImageCopy& region = regions[i];
+    region = {};
+    region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - oldBaseMip, 0, 1 };
+    region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - newBaseMip, 0, 1 };
+    region.extent = { texture::mip_dimension(header.Width, level), texture::mip_dimension(header.Height, level), 1 };
+  }
+
+  vkCmdCopyImage(
+    cmd,
+    oldImage.Src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    image.Src, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    copiedCount, regions.data()
+  );
+
+  // levels finer than the copied tail hold no data yet, minLod keeps them unused
+  init::cmd_image_barrier(cmd, image.Src, 0, levels,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+  // frames recorded before the descriptor swap still sample the old image
+  init::cmd_image_barrier(cmd, oldImage.Src, firstCopied - oldBaseMip, copiedCount,
+    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+  VkDeviceSize imageBytes = texture::mip_chain_size(header, newBaseMip);
+  TotalBytes = TotalBytes - streamed.ImageBytes + imageBytes;
+
+  streamed.ImageBytes = imageBytes;
+  streamed.ImageBaseMip = newBaseMip;
+  streamed.ResidentMip = firstCopied;
+
+  texture->Image = image;
+  texture->MipLevels = levels;
+  texture->Sampler = LodSamplers[firstCopied - newBaseMip];
+
+  streamed.DirtyImages = (1u << imageCount) - 1;
+
+  stPendingRelease release = {};
+  release.Image = oldImage;
+  release.Streamed = streamedIndex;
+  PendingReleases.push_back(release);
+}
+
+bool
+stTextureStreamer::Evict(
+  VkCommandBuffer cmd,
+  VkDeviceSize required,
+  uint32_t exclude,
+  uint32_t imageCount)
+{
+  // shrink textures that hold more detail than wanted, least recently used first
+  std::vector<uint32_t> candidates;
+  for (uint32_t i = 0; i < Textures.size(); i++)
+  {
+    if (i != exclude && Textures[i].ImageBaseMip < WantedMip(Textures[i]))
+    {
+      candidates.push_back(i);
+    }
+  }
+
+  std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+  {
+    return Textures[a].LastRequestFrame < Textures[b].LastRequestFrame;
+  });
+
+  for (uint32_t index : candidates)
+  {
+    if (TotalBytes + required <= Budget)
+    {
+      break;
+    }
+
+    Reallocate(cmd, index, WantedMip(Textures[index]), imageCount);
+  }
+
+  return TotalBytes + required <= Budget;
+}
+
+void
+stTextureStreamer::Update(
+  uint32_t imageCount)
+{
+  for (size_t i = 0; i < PendingReleases.size();)
+  {
+    stPendingRelease& release = PendingReleases[i];
+
+    // no descriptor names the old image anymore, frames in flight may
+    // still sample it
+    if (Textures[release.Streamed].DirtyImages == 0)
+    {
+      deferred::image(release.Image);
+      PendingReleases[i] = PendingReleases.back();
+      PendingReleases.pop_back();
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  // textures furthest from what they need are served first
+  std::vector<uint32_t> promotions;
+  for (uint32_t i = 0; i < Textures.size(); i++)
+  {
+    if (WantedMip(Textures[i]) < Textures[i].ResidentMip)
+    {
+      promotions.push_back(i);
+    }
+  }
+
+  if (promotions.empty() && TotalBytes <= Budget)
+  {
+    return;
+  }
+
+  std::sort(promotions.begin(), promotions.end(), [this](uint32_t a, uint32_t b)
+  {
+    return Textures[a].ResidentMip - WantedMip(Textures[a]) > Textures[b].ResidentMip - WantedMip(Textures[b]);
+  });
+
+  if (promotions.size() > TEXTURE_STREAMING_UPLOADS_PER_FRAME)
+  {
+    promotions.resize(TEXTURE_STREAMING_UPLOADS_PER_FRAME);
+  }
+
+  // promotions rewrite images the frames in flight sample, they stay on the
+  // graphics queue instead of moving the images between queues
+  VkCommandBuffer cmd = upload::graphics_cmd();
+
+  Evict(cmd, 0, UINT32_MAX, imageCount);
+
+  // grow images that have no room for the next finer level
+  for (uint32_t index : promotions)
+  {
+    stStreamedTexture& streamed = Textures[index];
+    if (streamed.ResidentMip > streamed.ImageBaseMip)
+    {
+      continue;
+    }
+
+    uint32_t newBaseMip = WantedMip(streamed);
+    VkDeviceSize required = texture::mip_chain_size(streamed.Header, newBaseMip) - streamed.ImageBytes;
+
+    if (Evict(cmd, required, index, imageCount))
+    {
+      Reallocate(cmd, index, newBaseMip, imageCount);
+    }
+  }
+
+  // one new level per texture per frame, staged together
+  VkDeviceSize stagingSize = 0;
+  for (uint32_t index : promotions)
+  {
+    stStreamedTexture& streamed = Textures[index];
+    if (streamed.ResidentMip > streamed.ImageBaseMip)
+    {
+      stagingSize += streamed.Header.Sizes[streamed.ResidentMip - 1];
+    }
+  }
+
+  VkBuffer staging = VK_NULL_HANDLE;
+  VkDeviceSize stagingBase = 0;
+  uint8_t* stagingData = nullptr;
+
+  if (stagingSize > 0)
+  {
+    // a full ring submits the pending batch, with the copies recorded so far
+    stagingData = upload::stage(stagingSize, 16, &staging, &stagingBase);
+    cmd = upload::graphics_cmd();
+  }
+
+  VkDeviceSize stagingOffset = 0;
+  for (uint32_t index : promotions)
+  {
+    stStreamedTexture& streamed = Textures[index];
+    if (streamed.ResidentMip <= streamed.ImageBaseMip)
+    {
+      continue;
+    }
+
+    const texture::stMipChainHeader& header = streamed.Header;
+    uint32_t level = streamed.ResidentMip - 1;
+    uint32_t mip = level - streamed.ImageBaseMip;
+
+    if (!texture::read_mip_levels(streamed.CookedPath.c_str(), header, level, level, stagingData + stagingOffset))
+    {
+      continue;
+    }
+
+    init::cmd_image_barrier(cmd, streamed.Texture->Image.Src, mip, 1,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = stagingBase + stagingOffset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mip;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { texture::mip_dimension(header.Width, level), texture::mip_dimension(header.Height, level), 1 };
+
+    vkCmdCopyBufferToImage(cmd, staging, streamed.Texture->Image.Src, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    init::cmd_image_barrier(cmd, streamed.Texture->Image.Src, mip, 1,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    stagingOffset += header.Sizes[level];
+
+    streamed.ResidentMip = level;
+    streamed.Texture->Sampler = LodSamplers[mip];
+    streamed.DirtyImages = (1u << imageCount) - 1;
+  }
+}
+
+void
+stTextureStreamer::UpdateDescriptors(
+  VkDescriptorSet* textureSets,
+  uint32_t imageIndex)
+{
+  uint32_t bit = 1u << imageIndex;
+
+  for (stStreamedTexture& streamed : Textures)
+  {
+    if (streamed.DirtyImages & bit)
+    {
+      init::update_descriptor_set(Device, textureSets[imageIndex], *streamed.Texture, streamed.Texture->DescriptorIndex);
+      streamed.DirtyImages &= ~bit;
+    }
+  }
+}
+
+void
+stTextureStreamer::Term()
+{
+  for (stPendingRelease& release : PendingReleases)
+  {
+    DestroyImage(release.Image);
+  }
+  PendingReleases.clear();
+
+  for (stStreamedTexture& streamed : Textures)
+  {
+    DestroyImage(streamed.Texture->Image);
+  }
+  Textures.clear();
+}
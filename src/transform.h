@@ -13,9 +13,18 @@ stTransformSystem
   std::unordered_map<uint64_t, glm::mat4> Tramsforms;
   std::unordered_map<uint64_t, glm::vec3> Positions;
 
+  // ids whose transform changed since the renderer last looked, may repeat
+  std::vector<uint64_t> Dirty;
+
   void
   GetTransform(glm::mat4* transform)
   {
     transform = &Tramsforms[TransformCount++];
   }
+
+  void
+  MarkDirty(uint64_t id)
+  {
+    Dirty.push_back(id);
+  }
 };
\ No newline at end of file
@@ -0,0 +1,582 @@
+
+// ############################################################################
+// # uploads
+// ############################################################################
+
+// Buffer and image uploads are recorded into one pending batch and go to
+// the GPU in one submission per frame, ahead of the frame's own commands.
+// Source data is staged in a persistently mapped ring; ring space and
+// retired buffers are reclaimed once the batch's fence signals, so loading
+// never waits for the queue to go idle. Main thread only.
+//
+// With a transfer-only queue family the copies run on that queue, next to
+// the frames still rendering, and a second command buffer on the graphics
+// queue waits for them through a semaphore. Resources written there change
+// owner with a release barrier on the transfer queue and the matching
+// acquire barrier on the graphics queue. Without one both command buffers
+// are the same.
+namespace upload
+{
+
+struct
+stBatch
+{
+  VkCommandBuffer Cmd = VK_NULL_HANDLE; // copies, on the transfer queue
+  VkCommandBuffer GraphicsCmd = VK_NULL_HANDLE; // acquires and graphics only work
+  VkSemaphore Semaphore = VK_NULL_HANDLE; // transfer -> graphics
+  VkFence Fence = VK_NULL_HANDLE;
+  VkDeviceSize RingEnd = 0; // ring space up to here is free once the fence signals
+  std::vector<stBuffer> Retired; // destroyed once the fence signals
+  std::vector<std::function<void()>> Deferred; // run once the fence signals
+};
+
+struct
+stQueueContext
+{
+  VkQueue Queue = VK_NULL_HANDLE;
+  uint32_t Family = 0;
+  VkCommandPool CommandPool = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> FreeCommandBuffers;
+};
+
+stDevice Device = {};
+stQueueContext Transfer = {};
+stQueueContext Graphics = {};
+bool Dedicated = false; // Transfer is its own queue family
+
+stBuffer Ring = {};
+VkDeviceSize RingSize = UPLOAD_RING_SIZE;
+VkDeviceSize Head = 0; // next free byte, Head == Tail means the ring is empty
+VkDeviceSize Tail = 0; // oldest byte a batch may still read
+
+stBatch Pending = {};
+std::deque<stBatch> InFlight;
+std::vector<VkFence> FreeFences;
+std::vector<VkSemaphore> FreeSemaphores;
+
+stBuffer
+create_staging_buffer(
+  VkDeviceSize size)
+{
+  stBuffer buffer = {};
+
+  VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+  bufferInfo.size = size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  // the graphics queue copies from the ring too
+  uint32_t families[] = { Transfer.Family, Graphics.Family };
+  if (Dedicated)
+  {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = ArrayCount(families);
+    bufferInfo.pQueueFamilyIndices = families;
+  }
+
+  VK_CHECK(vkCreateBuffer(Device.LogicalDevice, &bufferInfo, nullptr, &buffer.Buffer));
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(Device.LogicalDevice, buffer.Buffer, &memRequirements);
+
+  buffer.Allocation = memory::allocate(
+    memRequirements,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    MEMORY_CATEGORY_STAGING
+  );
+
+  VK_CHECK(vkBindBufferMemory(Device.LogicalDevice, buffer.Buffer, buffer.Allocation.Memory, buffer.Allocation.Offset));
+
+  return buffer;
+}
+
+void
+destroy_staging_buffer(
+  stBuffer& buffer)
+{
+  vkDestroyBuffer(Device.LogicalDevice, buffer.Buffer, nullptr);
+  memory::release(buffer.Allocation);
+  buffer = {};
+}
+
+void
+free_command_buffer(
+  stQueueContext& context,
+  VkCommandBuffer commandBuffer)
+{
+  if (commandBuffer != VK_NULL_HANDLE)
+  {
+    VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+    context.FreeCommandBuffers.push_back(commandBuffer);
+  }
+}
+
+// frees the resources of finished batches, oldest first; with block the
+// oldest batch is waited for even if it is still running
+bool
+reclaim(
+  bool block)
+{
+  bool reclaimed = false;
+
+  while (!InFlight.empty())
+  {
+    stBatch& batch = InFlight.front();
+
+    if (block && !reclaimed)
+    {
+      VK_CHECK(vkWaitForFences(Device.LogicalDevice, 1, &batch.Fence, VK_TRUE, ~0ull));
+    }
+    else if (vkGetFenceStatus(Device.LogicalDevice, batch.Fence) != VK_SUCCESS)
+    {
+      break;
+    }
+
+    for (stBuffer& buffer : batch.Retired)
+    {
+      destroy_staging_buffer(buffer);
+    }
+
+    for (std::function<void()>& function : batch.Deferred)
+    {
+      function();
+    }
+
+    VK_CHECK(vkResetFences(Device.LogicalDevice, 1, &batch.Fence));
+    FreeFences.push_back(batch.Fence);
+
+    if (batch.Semaphore != VK_NULL_HANDLE)
+    {
+      FreeSemaphores.push_back(batch.Semaphore);
+    }
+
+    free_command_buffer(Transfer, batch.Cmd);
+    free_command_buffer(Graphics, batch.GraphicsCmd);
+
+    Tail = batch.RingEnd;
+    InFlight.pop_front();
+    reclaimed = true;
+  }
+
+  // nothing in flight and nothing staged, start over at the front
+  if (InFlight.empty() && Head == Tail)
+  {
+    Head = Tail = 0;
+  }
+
+  return reclaimed;
+}
+
+VkCommandBuffer
+begin_command_buffer(
+  stQueueContext& context)
+{
+  if (context.FreeCommandBuffers.empty())
+  {
+    VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = context.CommandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VK_CHECK(vkAllocateCommandBuffers(Device.LogicalDevice, &allocInfo, &commandBuffer));
+    context.FreeCommandBuffers.push_back(commandBuffer);
+  }
+
+  VkCommandBuffer commandBuffer = context.FreeCommandBuffers.back();
+  context.FreeCommandBuffers.pop_back();
+
+  VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+  return commandBuffer;
+}
+
+// the pending transfer command buffer, begun on first use; only transfer
+// stages and accesses may be used in it
+VkCommandBuffer
+cmd()
+{
+  if (Pending.Cmd == VK_NULL_HANDLE)
+  {
+    Pending.Cmd = begin_command_buffer(Transfer);
+  }
+
+  return Pending.Cmd;
+}
+
+// the pending graphics command buffer, it runs after every copy of the
+// batch; blits and shader stage barriers go here
+VkCommandBuffer
+graphics_cmd()
+{
+  if (!Dedicated)
+  {
+    return cmd();
+  }
+
+  if (Pending.GraphicsCmd == VK_NULL_HANDLE)
+  {
+    Pending.GraphicsCmd = begin_command_buffer(Graphics);
+  }
+
+  return Pending.GraphicsCmd;
+}
+
+VkSemaphore
+get_semaphore()
+{
+  if (FreeSemaphores.empty())
+  {
+    VkSemaphoreCreateInfo semaphoreInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateSemaphore(Device.LogicalDevice, &semaphoreInfo, nullptr, &semaphore));
+    FreeSemaphores.push_back(semaphore);
+  }
+
+  VkSemaphore semaphore = FreeSemaphores.back();
+  FreeSemaphores.pop_back();
+  return semaphore;
+}
+
+// hands the pending batch to the queues; a final barrier on the graphics
+// queue makes every upload visible to all later work there
+void
+submit()
+{
+  reclaim(false);
+
+  if (Pending.Cmd == VK_NULL_HANDLE && Pending.GraphicsCmd == VK_NULL_HANDLE)
+  {
+    return;
+  }
+
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+  VkSubmitInfo graphicsSubmit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+
+  if (Dedicated && Pending.Cmd != VK_NULL_HANDLE)
+  {
+    VK_CHECK(vkEndCommandBuffer(Pending.Cmd));
+
+    Pending.Semaphore = get_semaphore();
+
+    VkSubmitInfo transferSubmit = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    transferSubmit.commandBufferCount = 1;
+    transferSubmit.pCommandBuffers = &Pending.Cmd;
+    transferSubmit.signalSemaphoreCount = 1;
+    transferSubmit.pSignalSemaphores = &Pending.Semaphore;
+
+    VK_CHECK(vkQueueSubmit(Transfer.Queue, 1, &transferSubmit, VK_NULL_HANDLE));
+
+    graphicsSubmit.waitSemaphoreCount = 1;
+    graphicsSubmit.pWaitSemaphores = &Pending.Semaphore;
+    graphicsSubmit.pWaitDstStageMask = &waitStage;
+  }
+
+  VkCommandBuffer commandBuffer = graphics_cmd();
+
+  VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+  barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  VK_CHECK(vkEndCommandBuffer(commandBuffer));
+
+  if (FreeFences.empty())
+  {
+    VkFenceCreateInfo fenceInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    VkFence fence = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateFence(Device.LogicalDevice, &fenceInfo, nullptr, &fence));
+    FreeFences.push_back(fence);
+  }
+
+  Pending.Fence = FreeFences.back();
+  FreeFences.pop_back();
+  Pending.RingEnd = Head;
+
+  // the fence covers the transfer submission too, the graphics one waits for it
+  graphicsSubmit.commandBufferCount = 1;
+  graphicsSubmit.pCommandBuffers = &commandBuffer;
+
+  VK_CHECK(vkQueueSubmit(Graphics.Queue, 1, &graphicsSubmit, Pending.Fence));
+
+  InFlight.push_back(std::move(Pending));
+  Pending = {};
+}
+
+// submits what is pending and blocks until every batch finished
+void
+wait()
+{
+  submit();
+  while (reclaim(true)) {}
+}
+
+bool
+ring_allocate(
+  VkDeviceSize size,
+  VkDeviceSize alignment,
+  VkDeviceSize* offset)
+{
+  VkDeviceSize aligned = (Head + alignment - 1) / alignment * alignment;
+
+  if (Head >= Tail)
+  {
+    // free space is [Head, RingSize) and [0, Tail)
+    if (aligned + size <= RingSize)
+    {
+      *offset = aligned;
+      Head = aligned + size;
+      return true;
+    }
+    if (size < Tail)
+    {
+      *offset = 0;
+      Head = size;
+      return true;
+    }
+    return false;
+  }
+
+  if (aligned + size < Tail)
+  {
+    *offset = aligned;
+    Head = aligned + size;
+    return true;
+  }
+  return false;
+}
+
+// staging memory for one copy, valid until the pending batch finished
+uint8_t*
+stage(
+  VkDeviceSize size,
+  VkDeviceSize alignment,
+  VkBuffer* buffer,
+  VkDeviceSize* offset)
+{
+  // the staged bytes belong to the pending batch, so it has to exist
+  cmd();
+
+  // copies as large as half the ring would stall it, they get their own buffer
+  if (size <= RingSize / 2)
+  {
+    while (!ring_allocate(size, alignment, offset))
+    {
+      // the pending batch may hold the space, hand it over first
+      if (InFlight.empty())
+      {
+        submit();
+      }
+      reclaim(true);
+    }
+
+    *buffer = Ring.Buffer;
+    return Ring.Allocation.Mapped + *offset;
+  }
+
+  stBuffer staging = create_staging_buffer(size);
+  Pending.Retired.push_back(staging);
+
+  *buffer = staging.Buffer;
+  *offset = 0;
+  return staging.Allocation.Mapped;
+}
+
+void
+buffer(
+  VkBuffer dst,
+  VkDeviceSize dstOffset,
+  const void* data,
+  VkDeviceSize size)
+{
+  VkBuffer source = VK_NULL_HANDLE;
+  VkDeviceSize sourceOffset = 0;
+  memcpy(stage(size, 16, &source, &sourceOffset), data, (size_t)size);
+
+  VkBufferCopy region = {};
+  region.srcOffset = sourceOffset;
+  region.dstOffset = dstOffset;
+  region.size = size;
+  vkCmdCopyBuffer(cmd(), source, dst, 1, &region);
+}
+
+// hands a buffer written by cmd() over to the graphics queue, not needed
+// for buffers created shared
+void
+release_buffer(
+  VkBuffer buffer,
+  VkDeviceSize offset,
+  VkDeviceSize size)
+{
+  if (!Dedicated)
+  {
+    return;
+  }
+
+  VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+  barrier.srcQueueFamilyIndex = Transfer.Family;
+  barrier.dstQueueFamilyIndex = Graphics.Family;
+  barrier.buffer = buffer;
+  barrier.offset = offset;
+  barrier.size = size;
+
+  // release, the destination access is ignored on this side
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  vkCmdPipelineBarrier(cmd(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+  // acquire, the source access is ignored on this side
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  vkCmdPipelineBarrier(graphics_cmd(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// hands color mips written by cmd() over to the graphics queue, moving
+// them from oldLayout to newLayout on the way
+void
+release_image(
+  VkImage image,
+  uint32_t baseMipLevel,
+  uint32_t levelCount,
+  VkImageLayout oldLayout,
+  VkImageLayout newLayout,
+  VkPipelineStageFlags dstStage,
+  VkAccessFlags dstAccessMask)
+{
+  VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = baseMipLevel;
+  barrier.subresourceRange.levelCount = levelCount;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  if (!Dedicated)
+  {
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dstAccessMask;
+    vkCmdPipelineBarrier(cmd(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    return;
+  }
+
+  // both sides have to name the same layout transition
+  barrier.srcQueueFamilyIndex = Transfer.Family;
+  barrier.dstQueueFamilyIndex = Graphics.Family;
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  vkCmdPipelineBarrier(cmd(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = dstAccessMask;
+  vkCmdPipelineBarrier(graphics_cmd(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// destroys a buffer created through memory::allocate once the work
+// recorded so far finished
+void
+retire(
+  const stBuffer& buffer)
+{
+  cmd();
+  Pending.Retired.push_back(buffer);
+}
+
+// runs function once the work recorded so far finished, for views and
+// descriptor sets only the pending batch uses
+void
+defer(
+  std::function<void()>&& function)
+{
+  cmd();
+  Pending.Deferred.push_back(std::move(function));
+}
+
+void
+destroy_context(
+  stQueueContext& context)
+{
+  context.FreeCommandBuffers.clear();
+
+  if (context.CommandPool != VK_NULL_HANDLE)
+  {
+    vkDestroyCommandPool(Device.LogicalDevice, context.CommandPool, nullptr);
+  }
+  context = {};
+}
+
+void
+term()
+{
+  wait();
+
+  for (VkFence fence : FreeFences)
+  {
+    vkDestroyFence(Device.LogicalDevice, fence, nullptr);
+  }
+  FreeFences.clear();
+
+  for (VkSemaphore semaphore : FreeSemaphores)
+  {
+    vkDestroySemaphore(Device.LogicalDevice, semaphore, nullptr);
+  }
+  FreeSemaphores.clear();
+
+  destroy_staging_buffer(Ring);
+  destroy_context(Transfer);
+  destroy_context(Graphics);
+}
+
+void
+create_context(
+  stQueueContext& context,
+  const stQueue& queue)
+{
+  context.Queue = queue.Queue;
+  context.Family = queue.Index;
+
+  VkCommandPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = queue.Index;
+
+  VK_CHECK(vkCreateCommandPool(Device.LogicalDevice, &poolInfo, nullptr, &context.CommandPool));
+}
+
+void
+init(
+  const stDevice& device,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device;
+  Dedicated = device.Queues[QUEUE_TYPE_TRANSFER].Index != device.Queues[QUEUE_TYPE_GRAPHICS].Index;
+
+  create_context(Transfer, device.Queues[QUEUE_TYPE_TRANSFER]);
+
+  if (Dedicated)
+  {
+    create_context(Graphics, device.Queues[QUEUE_TYPE_GRAPHICS]);
+  }
+  else
+  {
+    Graphics.Queue = Transfer.Queue;
+    Graphics.Family = Transfer.Family;
+  }
+
+  Ring = create_staging_buffer(RingSize);
+
+  if (deletionQueue)
+  deletionQueue->PushFunction([=]{
+    term();
+  });
+}
+
+}
@@ -1,8 +1,17 @@
 
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
 #include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
 #include <array>
-#include <sstream>
\ No newline at end of file
+#include <sstream>
+#include <thread>
+#include <xmmintrin.h>
+#include <sys/types.h>
+#include <sys/stat.h>
\ No newline at end of file
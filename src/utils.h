@@ -19,4 +19,22 @@ T Clip(const T& n, const T& lower, const T& upper) {
   return Max(lower, Min(n, upper));
 }
 
+// size and last write time of a file, false when it does not exist
+bool
+FileStamp(
+  const char* path,
+  uint64_t* size,
+  uint64_t* time)
+{
+  struct _stat64 info;
+  if (_stat64(path, &info) != 0)
+  {
+    return false;
+  }
+
+  *size = (uint64_t)info.st_size;
+  *time = (uint64_t)info.st_mtime;
+  return true;
+}
+
 }
\ No newline at end of file
@@ -157,19 +157,41 @@ create_device(
     queueFamilies
   );
 
+  bool transferFound = false;
+
   for (uint32_t i = 0; i < queueFamilyCount; i++)
   {
-    if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+    VkQueueFlags flags = queueFamilies[i].queueFlags;
+
+    if (flags & VK_QUEUE_GRAPHICS_BIT)
     {
       device.Queues[QUEUE_TYPE_GRAPHICS].Index = i;
       VkBool32 presentSupport = false;
       vkGetPhysicalDeviceSurfaceSupportKHR(device.PhysicalDevice, i, surface, &presentSupport);
       assert(presentSupport);
     }
-    else if(queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
+    else if(flags & VK_QUEUE_COMPUTE_BIT)
     {
        device.Queues[QUEUE_TYPE_COMPUTE].Index = i;
     }
+#if TRANSFER_QUEUE
+    // a family with nothing but copies is usually backed by the dma engines
+    else if ((flags & VK_QUEUE_TRANSFER_BIT) && !transferFound)
+    {
+      device.Queues[QUEUE_TYPE_TRANSFER].Index = i;
+      transferFound = true;
+    }
+#endif
+  }
+
+  if (!transferFound)
+  {
+    device.Queues[QUEUE_TYPE_TRANSFER].Index = device.Queues[QUEUE_TYPE_GRAPHICS].Index;
+  }
+
+  for (uint32_t i = 0; i < QUEUE_TYPE_COUNT; i++)
+  {
+    device.Queues[i].Type = (enQueueType)i;
   }
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
@@ -181,20 +203,63 @@ create_device(
   };
   queueCreateInfo.queueCount = 1;
   queueCreateInfo.pQueuePriorities = &queuePriority;
-  queueCreateInfo.queueFamilyIndex = device.Queues[QUEUE_TYPE_GRAPHICS].Index;
-  queueCreateInfos.push_back(queueCreateInfo);
-  queueCreateInfo.queueFamilyIndex = device.Queues[QUEUE_TYPE_COMPUTE].Index;
-  queueCreateInfos.push_back(queueCreateInfo);
+
+  // a family may be listed only once
+  for (uint32_t i = 0; i < QUEUE_TYPE_COUNT; i++)
+  {
+    bool listed = false;
+    for (const VkDeviceQueueCreateInfo& info : queueCreateInfos)
+    {
+      listed |= info.queueFamilyIndex == device.Queues[i].Index;
+    }
+
+    if (!listed)
+    {
+      queueCreateInfo.queueFamilyIndex = device.Queues[i].Index;
+      queueCreateInfos.push_back(queueCreateInfo);
+    }
+  }
 
   VkPhysicalDeviceFeatures deviceFeatures = {};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
   deviceFeatures.sampleRateShading = VK_TRUE;
 
-  const char* deviceExtensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+  // the bindless texture array, see create_gfx_pipeline
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexing = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+  VkPhysicalDeviceFeatures2 supportedFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+  supportedFeatures.pNext = &supportedIndexing;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+
+  assert(supportedIndexing.shaderSampledImageArrayNonUniformIndexing
+    && supportedIndexing.runtimeDescriptorArray
+    && supportedIndexing.descriptorBindingPartiallyBound
+    && supportedIndexing.descriptorBindingSampledImageUpdateAfterBind
+    && supportedIndexing.descriptorBindingUpdateUnusedWhilePending);
+
+  // indirect draws pick their object with firstInstance, without it the
+  // renderer records one draw per command
+#if MULTI_DRAW_INDIRECT
+  if (supportedFeatures.features.multiDrawIndirect && supportedFeatures.features.drawIndirectFirstInstance)
+  {
+    deviceFeatures.multiDrawIndirect = VK_TRUE;
+    deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    device.MultiDrawIndirect = true;
+  }
+#endif
+
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+  indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+  indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+  indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+  indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+  const char* deviceExtensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME };
 
   VkDeviceCreateInfo deviceCreateInfo = { 
     VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO
   };
+  deviceCreateInfo.pNext = &indexingFeatures;
   deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(
     queueCreateInfos.size()
   );
@@ -215,6 +280,12 @@ create_device(
     0, &device.Queues[QUEUE_TYPE_GRAPHICS].Queue
   );
 
+  vkGetDeviceQueue(
+    device.LogicalDevice,
+    device.Queues[QUEUE_TYPE_TRANSFER].Index,
+    0, &device.Queues[QUEUE_TYPE_TRANSFER].Queue
+  );
+
   if (deletionQueue)
   deletionQueue->PushFunction([=]{
     vkDestroyDevice(device.LogicalDevice, nullptr);
@@ -247,7 +318,8 @@ create_image_view(
   VkFormat format,
   VkImageAspectFlags aspectFlags,
   uint32_t mipLevels,
-  stDeletionQueue* deleteionQueue = nullptr)
+  stDeletionQueue* deleteionQueue = nullptr,
+  VkImageUsageFlags usage = 0)
 {
   VkImageViewCreateInfo viewInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
   viewInfo.image = image.Src;
@@ -259,6 +331,14 @@ create_image_view(
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = 1;
 
+  // narrows the usage of EXTENDED_USAGE images to what format supports
+  VkImageViewUsageCreateInfo usageInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO };
+  usageInfo.usage = usage;
+  if (usage != 0)
+  {
+    viewInfo.pNext = &usageInfo;
+  }
+
   // viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
   // viewInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
   // viewInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -791,33 +871,62 @@ create_gfx_pipeline(
   VkExtent2D windowExtend,
   VkRenderPass renderPass,
   VkSampleCountFlagBits msaaSamples,
-  stDeletionQueue* deletionQueue)
+  stDeletionQueue* deletionQueue,
+  VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT,
+  bool blend = false)
 {
   stGfxPipeline pipeline = {};
 
+  // every texture, indexed by its DescriptorIndex; slots without a
+  // texture stay unwritten and the renderer rewrites slots of sets bound
+  // in frames still in flight
   VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
   samplerLayoutBinding.binding = 0;
-  samplerLayoutBinding.descriptorCount = 1;
+  samplerLayoutBinding.descriptorCount = MAX_BINDLESS_TEXTURES;
   samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
   samplerLayoutBinding.pImmutableSamplers = nullptr;
   samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-  VkDescriptorSetLayoutBinding objectLayoutBinding = {};
-  objectLayoutBinding.binding = 0;
-  objectLayoutBinding.descriptorCount = 1;
-  objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  objectLayoutBinding.pImmutableSamplers = nullptr;
-  objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  // per object data, the material table, then the object of each instance
+  VkDescriptorSetLayoutBinding objectLayoutBindings[3] = {};
+  objectLayoutBindings[0].binding = 0;
+  objectLayoutBindings[0].descriptorCount = 1;
+  objectLayoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  objectLayoutBindings[0].pImmutableSamplers = nullptr;
+  objectLayoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  objectLayoutBindings[1].binding = 1;
+  objectLayoutBindings[1].descriptorCount = 1;
+  objectLayoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  objectLayoutBindings[1].pImmutableSamplers = nullptr;
+  objectLayoutBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  objectLayoutBindings[2].binding = 2;
+  objectLayoutBindings[2].descriptorCount = 1;
+  objectLayoutBindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  objectLayoutBindings[2].pImmutableSamplers = nullptr;
+  objectLayoutBindings[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorBindingFlagsEXT samplerBindingFlags =
+    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+    VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfoEXT samplerFlagsInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT };
+  samplerFlagsInfo.bindingCount = 1;
+  samplerFlagsInfo.pBindingFlags = &samplerBindingFlags;
 
   VkDescriptorSetLayoutCreateInfo samplerLayoutInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+  samplerLayoutInfo.pNext = &samplerFlagsInfo;
+  samplerLayoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
   samplerLayoutInfo.bindingCount = 1;
   samplerLayoutInfo.pBindings = &samplerLayoutBinding;
 
   VK_CHECK(vkCreateDescriptorSetLayout(device.LogicalDevice, &samplerLayoutInfo, nullptr, &pipeline.SamplerLayout));
 
   VkDescriptorSetLayoutCreateInfo objectLayoutInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-  objectLayoutInfo.bindingCount = 1;
-  objectLayoutInfo.pBindings = &objectLayoutBinding;
+  objectLayoutInfo.bindingCount = ArrayCount(objectLayoutBindings);
+  objectLayoutInfo.pBindings = objectLayoutBindings;
 
   VK_CHECK(vkCreateDescriptorSetLayout(device.LogicalDevice, &objectLayoutInfo, nullptr, &pipeline.ObjectLayout));
 
@@ -863,12 +972,21 @@ create_gfx_pipeline(
 	pipeline_builder.Scissor.offset = { 0, 0 };
 	pipeline_builder.Scissor.extent = windowExtend;
 
-  pipeline_builder.Rasterizer = rasterization_state_create_info(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+  pipeline_builder.Rasterizer = rasterization_state_create_info(VK_POLYGON_MODE_FILL, cullMode, VK_FRONT_FACE_COUNTER_CLOCKWISE);
 
   pipeline_builder.Multisampling = multisampling_state_create_info(true, msaaSamples, 0.2f);
 
   pipeline_builder.ColorBlendAttachment = color_blend_attachment_state();
 
+  // alpha blended surfaces are drawn last, over the depth of the opaque ones
+  if (blend)
+  {
+    pipeline_builder.ColorBlendAttachment.blendEnable = VK_TRUE;
+    pipeline_builder.ColorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    pipeline_builder.ColorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    pipeline_builder.DepthWrite = VK_FALSE;
+  }
+
 	pipeline_builder.PipelineLayout = pipeline.Layout;
 
 	pipeline.Pipeline = pipeline_builder.build_pipeline(device.LogicalDevice, renderPass);
@@ -887,23 +1005,54 @@ create_gfx_pipeline(
   return pipeline;
 }
 
-uint32_t
-find_memory_type(
-  stDevice device,
-  uint32_t typeFilter,
-  VkMemoryPropertyFlags properties)
+stComputePipeline
+create_compute_pipeline(
+  const stDevice& device,
+  const char* shaderPath,
+  const VkDescriptorSetLayoutBinding* bindings,
+  uint32_t bindingCount,
+  uint32_t pushConstantSize,
+  stDeletionQueue* deletionQueue)
 {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(device.PhysicalDevice, &memProperties);
+  stComputePipeline pipeline = {};
 
-  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-      if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-          return i;
-      }
-  }
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+  setLayoutInfo.bindingCount = bindingCount;
+  setLayoutInfo.pBindings = bindings;
 
-  assert(false);
-  return 0;
+  VK_CHECK(vkCreateDescriptorSetLayout(device.LogicalDevice, &setLayoutInfo, nullptr, &pipeline.SetLayout));
+
+  VkPushConstantRange pushConstant = {};
+  pushConstant.offset = 0;
+  pushConstant.size = pushConstantSize;
+  pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layoutInfo = pipeline_layout_create_info();
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &pipeline.SetLayout;
+  layoutInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+  layoutInfo.pPushConstantRanges = &pushConstant;
+
+  VK_CHECK(vkCreatePipelineLayout(device.LogicalDevice, &layoutInfo, nullptr, &pipeline.Layout));
+
+  VkShaderModule shaderModule = load_shader_module(device, shaderPath);
+
+  VkComputePipelineCreateInfo pipelineInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+  pipelineInfo.stage = pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, shaderModule);
+  pipelineInfo.layout = pipeline.Layout;
+
+  VK_CHECK(vkCreateComputePipelines(device.LogicalDevice, pipeline_cache::Cache, 1, &pipelineInfo, nullptr, &pipeline.Pipeline));
+
+  vkDestroyShaderModule(device.LogicalDevice, shaderModule, nullptr);
+
+  if (deletionQueue)
+  deletionQueue->PushFunction([=]{
+    vkDestroyPipeline(device.LogicalDevice, pipeline.Pipeline, nullptr);
+    vkDestroyPipelineLayout(device.LogicalDevice, pipeline.Layout, nullptr);
+    vkDestroyDescriptorSetLayout(device.LogicalDevice, pipeline.SetLayout, nullptr);
+  });
+
+  return pipeline;
 }
 
 void
@@ -913,33 +1062,56 @@ create_buffer(
   VkBufferUsageFlags usage,
   VkMemoryPropertyFlags properties,
   stBuffer& buffer,
-  stDeletionQueue* deletionQueue)
+  stDeletionQueue* deletionQueue,
+  bool shared = false)
 {
   VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
   bufferInfo.size = size;
   bufferInfo.usage = usage;
   bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+  // buffers written in place by uploads while frames read them skip the
+  // ownership transfers and are used by both queues at once
+  uint32_t families[] = { device.Queues[QUEUE_TYPE_GRAPHICS].Index, device.Queues[QUEUE_TYPE_TRANSFER].Index };
+  if (shared && families[0] != families[1])
+  {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = ArrayCount(families);
+    bufferInfo.pQueueFamilyIndices = families;
+  }
+
   VK_CHECK(vkCreateBuffer(device.LogicalDevice, &bufferInfo, nullptr, &buffer.Buffer));
 
   VkMemoryRequirements memRequirements;
   vkGetBufferMemoryRequirements(device.LogicalDevice, buffer.Buffer, &memRequirements);
 
-  VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = find_memory_type(device, memRequirements.memoryTypeBits, properties);
+  // upload sources get their own pool, they come and go every load
+  enMemoryCategory category = usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    ? MEMORY_CATEGORY_STAGING
+    : MEMORY_CATEGORY_BUFFER;
 
-  VK_CHECK(vkAllocateMemory(device.LogicalDevice, &allocInfo, nullptr, &buffer.Memory));
+  buffer.Allocation = memory::allocate(memRequirements, properties, category);
 
-  vkBindBufferMemory(device.LogicalDevice, buffer.Buffer, buffer.Memory, 0);
+  VK_CHECK(vkBindBufferMemory(device.LogicalDevice, buffer.Buffer, buffer.Allocation.Memory, buffer.Allocation.Offset));
 
   if (deletionQueue)
   deletionQueue->PushFunction([=]{
+    stAllocation allocation = buffer.Allocation;
     vkDestroyBuffer(device.LogicalDevice, buffer.Buffer, nullptr);
-    vkFreeMemory(device.LogicalDevice, buffer.Memory, nullptr);
+    memory::release(allocation);
   });
 }
 
+void
+destroy_buffer(
+  const stDevice& device,
+  stBuffer& buffer)
+{
+  vkDestroyBuffer(device.LogicalDevice, buffer.Buffer, nullptr);
+  memory::release(buffer.Allocation);
+  buffer = {};
+}
+
 VkCommandBuffer
 begin_single_time_commands(
   const stDevice& device,
@@ -1044,10 +1216,12 @@ create_descriptor_pools(
   VkDescriptorPoolSize* poolSizes, 
   uint32_t poolCount,
   uint32_t maxSets,
-  stDeletionQueue* deletionQueue
+  stDeletionQueue* deletionQueue,
+  VkDescriptorPoolCreateFlags flags = 0
 )
 {
   VkDescriptorPoolCreateInfo poolInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+  poolInfo.flags = flags;
   poolInfo.poolSizeCount = poolCount;
   poolInfo.pPoolSizes = poolSizes;
   poolInfo.maxSets = maxSets;
@@ -1129,7 +1303,8 @@ void
 update_descriptor_set(
   const stDevice& device,
   VkDescriptorSet descriptorSet,
-  const stTexture& texture
+  const stTexture& texture,
+  uint32_t arrayElement = 0
   )
 {
   VkDescriptorImageInfo imageInfo = {};
@@ -1138,6 +1313,7 @@ update_descriptor_set(
   imageInfo.sampler = texture.Sampler;
 
   VkWriteDescriptorSet descriptorWrite = write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptorSet, &imageInfo, 0);
+  descriptorWrite.dstArrayElement = arrayElement;
 
   vkUpdateDescriptorSets(device.LogicalDevice, 1, &descriptorWrite, 0, nullptr);
 }
@@ -1192,7 +1368,8 @@ create_image(
   VkFormat format,
   VkImageTiling tiling,
   VkImageUsageFlags usage,
-  VkMemoryPropertyFlags properties)
+  VkMemoryPropertyFlags properties,
+  VkImageCreateFlags flags = 0)
 {
   stImage image = {};
 
@@ -1209,29 +1386,67 @@ create_image(
   imageInfo.usage = usage;
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
   imageInfo.samples = numSample;
-  imageInfo.flags = 0; // Optional
+  imageInfo.flags = flags;
   
   VK_CHECK(vkCreateImage(device.LogicalDevice, &imageInfo, nullptr, &image.Src));
 
   VkMemoryRequirements memRequirements;
   vkGetImageMemoryRequirements(device.LogicalDevice, image.Src, &memRequirements);
-  
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = find_memory_type(device, memRequirements.memoryTypeBits, properties);
-  
-  VK_CHECK(vkAllocateMemory(device.LogicalDevice, &allocInfo, nullptr, &image.Memory));
-  
-  vkBindImageMemory(device.LogicalDevice, image.Src, image.Memory, 0);
+
+  // render targets are recreated with the swapchain, keep them apart from textures
+  VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  enMemoryCategory category = (usage & attachmentUsage) ? MEMORY_CATEGORY_ATTACHMENT : MEMORY_CATEGORY_IMAGE;
+
+  // pools keep optimal images apart from buffers, only optimal tiling is used
+  assert(tiling == VK_IMAGE_TILING_OPTIMAL);
+
+  image.Allocation = memory::allocate(memRequirements, properties, category);
+
+  VK_CHECK(vkBindImageMemory(device.LogicalDevice, image.Src, image.Allocation.Memory, image.Allocation.Offset));
 
   return image;
 }
 
+void
+cmd_image_barrier(
+  VkCommandBuffer commandBuffer,
+  VkImage image,
+  uint32_t baseMipLevel,
+  uint32_t levelCount,
+  VkImageLayout oldLayout,
+  VkImageLayout newLayout,
+  VkAccessFlags srcAccessMask,
+  VkAccessFlags dstAccessMask,
+  VkPipelineStageFlags srcStage,
+  VkPipelineStageFlags dstStage)
+{
+  VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcAccessMask = srcAccessMask;
+  barrier.dstAccessMask = dstAccessMask;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = baseMipLevel;
+  barrier.subresourceRange.levelCount = levelCount;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier(
+    commandBuffer,
+    srcStage, dstStage,
+    0,
+    0, nullptr,
+    0, nullptr,
+    1, &barrier
+  );
+}
+
 void
 transition_image_layout(
-  const stDevice& device,
-  VkCommandPool commandPool,
+  VkCommandBuffer commandBuffer,
   VkImage image,
   VkFormat format,
   VkImageLayout oldLayout,
@@ -1239,8 +1454,6 @@ transition_image_layout(
   uint32_t mipLevels
 )
 {
-  VkCommandBuffer commandBuffer = begin_single_time_commands(device, commandPool);
-
   VkImageMemoryBarrier barrier{};
   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
   barrier.oldLayout = oldLayout;
@@ -1310,23 +1523,19 @@ transition_image_layout(
     0, nullptr,
     1, &barrier
   );
-
-  end_single_time_command(device, commandPool, commandBuffer);
 }
 
 void
 copy_buffer_to_image(
-  const stDevice& device,
-  VkCommandPool commandPool,
+  VkCommandBuffer commandBuffer,
   VkBuffer buffer,
+  VkDeviceSize bufferOffset,
   VkImage image,
   uint32_t width,
   uint32_t height)
 {
-  VkCommandBuffer commandBuffer = begin_single_time_commands(device, commandPool);
-
   VkBufferImageCopy region{};
-  region.bufferOffset = 0;
+  region.bufferOffset = bufferOffset;
   region.bufferRowLength = 0;
   region.bufferImageHeight = 0;
   
@@ -1350,14 +1559,12 @@ copy_buffer_to_image(
     1,
     &region
   );
-
-  end_single_time_command(device, commandPool, commandBuffer);
 }
 
 void
 generate_mipmaps(
   const stDevice& device,
-  VkCommandPool commandPool,
+  VkCommandBuffer commandBuffer,
   VkImage image,
   VkFormat imageFormat,
   int32_t texWidth,
@@ -1373,8 +1580,6 @@ generate_mipmaps(
     assert(false);
   }
 
-  VkCommandBuffer commandBuffer = begin_single_time_commands(device, commandPool);
-
   VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
   barrier.image = image;
   barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -1451,8 +1656,6 @@ generate_mipmaps(
     0, nullptr,
     1, &barrier
   );
-
-  end_single_time_command(device, commandPool, commandBuffer);
 }
 
 stTexture
@@ -1469,22 +1672,23 @@ create_texture_image(
   VkDeviceSize imageSize = texWidth * texHeight * 4;
   assert(pixels);
 
-  stBuffer staging;
+  VkBuffer staging = VK_NULL_HANDLE;
+  VkDeviceSize stagingOffset = 0;
+  memcpy(upload::stage(imageSize, 16, &staging, &stagingOffset), pixels, static_cast<size_t>(imageSize));
 
-  create_buffer(
-    device,
-    imageSize,
-    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    staging, nullptr
-  ); 
+  stbi_image_free(pixels);
 
-  void* data;
-  vkMapMemory(device.LogicalDevice, staging.Memory, 0, imageSize, 0, &data);
-      memcpy(data, pixels, static_cast<size_t>(imageSize));
-  vkUnmapMemory(device.LogicalDevice, staging.Memory);
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(device.PhysicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &formatProperties);
+  bool linearBlit = formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
 
-  stbi_image_free(pixels);
+  // blits cannot filter the format without linear filtering support
+  bool computeMips = downsample::supported(texture.MipLevels) && (COMPUTE_MIPMAPS || !linearBlit);
+  assert(computeMips || linearBlit || texture.MipLevels == 1);
+
+  // the unorm storage views of the compute path need a mutable format
+  VkImageUsageFlags storageUsage = computeMips ? VK_IMAGE_USAGE_STORAGE_BIT : 0;
+  VkImageCreateFlags flags = computeMips ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT : 0;
 
   texture.Image = create_image(
     device,
@@ -1496,13 +1700,16 @@ create_texture_image(
     VK_IMAGE_TILING_OPTIMAL,
     VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
     VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-    VK_IMAGE_USAGE_SAMPLED_BIT,
-    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    VK_IMAGE_USAGE_SAMPLED_BIT |
+    storageUsage,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    flags
   );
 
+  VkCommandBuffer cmd = upload::cmd();
+
   transition_image_layout(
-    device,
-    commandPool,
+    cmd,
     texture.Image.Src,
     VK_FORMAT_R8G8B8A8_SRGB,
     VK_IMAGE_LAYOUT_UNDEFINED,
@@ -1511,14 +1718,25 @@ create_texture_image(
   );
 
   copy_buffer_to_image(
-    device,
-    commandPool,
-    staging.Buffer,
+    cmd,
+    staging,
+    stagingOffset,
     texture.Image.Src,
     static_cast<uint32_t>(texWidth),
     static_cast<uint32_t>(texHeight)
   );
 
+  // the mips are built on the graphics queue
+  upload::release_image(
+    texture.Image.Src,
+    0,
+    texture.MipLevels,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT
+  );
+
   //transition_image_layout(
   //  device,
   //  commandPool,
@@ -1529,22 +1747,57 @@ create_texture_image(
   //  1
   //);
 
-  generate_mipmaps(device, commandPool, texture.Image.Src, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, texture.MipLevels);
-
-  vkDestroyBuffer(device.LogicalDevice, staging.Buffer, nullptr);
-  vkFreeMemory(device.LogicalDevice, staging.Memory, nullptr);
+  if (computeMips)
+  {
+    downsample::record(texture.Image.Src, true, texWidth, texHeight, texture.MipLevels);
+  }
+  else
+  {
+    generate_mipmaps(device, upload::graphics_cmd(), texture.Image.Src, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, texture.MipLevels);
+  }
 
   return texture;
 }
 
+// sampler state that tells cached samplers apart, the rest is the same
+// for every sampler
+struct
+stSamplerKey
+{
+  VkFilter Filter = VK_FILTER_LINEAR;
+  VkSamplerAddressMode AddressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  VkBorderColor BorderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  float MinLod = 0.0f;
+
+  bool
+  operator==(
+    const stSamplerKey& other) const
+  {
+    return Filter == other.Filter
+      && AddressMode == other.AddressMode
+      && BorderColor == other.BorderColor
+      && MinLod == other.MinLod;
+  }
+};
+
+struct
+stCachedSampler
+{
+  stSamplerKey Key = {};
+  VkSampler Sampler = VK_NULL_HANDLE;
+};
+
+// owned by the cache, never destroyed by the textures using them
+std::vector<stCachedSampler> Samplers;
+
+// maxLod is unclamped, so one sampler serves textures of any mip count
 VkSampler
 create_sampler(
   const stDevice& device,
   VkFilter filter,
   VkSamplerAddressMode addressMode,
   VkBorderColor borderColor,
-
-  uint32_t mipLevels)
+  float minLod = 0.0f)
 {
   VkSamplerCreateInfo samplerInfo{};
   samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1567,44 +1820,99 @@ create_sampler(
   samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
   samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
   samplerInfo.mipLodBias = 0.0f;
-  samplerInfo.minLod = 0.0f;
-  samplerInfo.maxLod = (float) mipLevels;
+  samplerInfo.minLod = minLod;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
   VkSampler sampler;
   VK_CHECK(vkCreateSampler(device.LogicalDevice, &samplerInfo, nullptr, &sampler));
   return sampler;
 }
 
+// the cached sampler for this state, created on first use
 VkSampler
-create_texture_sampler(
+get_sampler(
   const stDevice& device,
-  uint32_t mipLevels)
+  VkFilter filter,
+  VkSamplerAddressMode addressMode,
+  VkBorderColor borderColor,
+  float minLod = 0.0f)
 {
-  return create_sampler(
+  stSamplerKey key = {};
+  key.Filter = filter;
+  key.AddressMode = addressMode;
+  key.BorderColor = borderColor;
+  key.MinLod = minLod;
+
+  for (const stCachedSampler& cached : Samplers)
+  {
+    if (cached.Key == key)
+    {
+      return cached.Sampler;
+    }
+  }
+
+  stCachedSampler cached = {};
+  cached.Key = key;
+  cached.Sampler = create_sampler(device, filter, addressMode, borderColor, minLod);
+  Samplers.push_back(cached);
+
+  return cached.Sampler;
+}
+
+void
+destroy_samplers(
+  const stDevice& device)
+{
+  for (const stCachedSampler& cached : Samplers)
+  {
+    vkDestroySampler(device.LogicalDevice, cached.Sampler, nullptr);
+  }
+  Samplers.clear();
+}
+
+VkSampler
+create_texture_sampler(
+  const stDevice& device)
+{
+  return get_sampler(
     device,
     VK_FILTER_LINEAR,
     VK_SAMPLER_ADDRESS_MODE_REPEAT,
-    VK_BORDER_COLOR_INT_OPAQUE_BLACK,
-    mipLevels
+    VK_BORDER_COLOR_INT_OPAQUE_BLACK
   );
 }
 
-uint32_t TextureCounter = 0;
-stTexture Textures[MAX_TEXTURE_COUNT];
-std::unordered_map<std::string, stTexture*> CachedTextures;
+stResourceTable<stTexture> Textures;
+std::unordered_map<std::string, stTextureHandle> CachedTextures;
 
 stTexture*
 get_texture(
   uint32_t index)
 {
-  return &Textures[index];
+  return Textures.IsAlive(index) ? &Textures.Slot(index) : nullptr;
 }
 
 stTexture*
 get_texture(
   std::string key)
 {
-  return CachedTextures[key];
+  auto it = CachedTextures.find(key);
+  return it != CachedTextures.end() ? Textures.Get(it->second) : nullptr;
+}
+
+// the slot index doubles as the texture's index in the bindless array
+stTexture*
+register_texture(
+  const char* path)
+{
+  stTextureHandle handle = Textures.Create();
+  stTexture* texture = Textures.Get(handle);
+  assert(handle.Index < MAX_BINDLESS_TEXTURES);
+
+  texture->DescriptorIndex = handle.Index;
+  CachedTextures[path] = handle;
+
+  return texture;
 }
 
 stTexture
@@ -1614,24 +1922,21 @@ create_texture(
   const char* path,
   stDeletionQueue* deletionQueue)
 {
-  stTexture* texture = &Textures[TextureCounter];
+  stTexture* texture = register_texture(path);
 
+  uint32_t descriptorIndex = texture->DescriptorIndex;
   *texture = create_texture_image(device, commandPool, path);
+  texture->DescriptorIndex = descriptorIndex;
 
-  texture->DescriptorSetIndex = TextureCounter;
-  CachedTextures[path] = texture;
-  TextureCounter++;
-
-  create_image_view(device, texture->Image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, texture->MipLevels, deletionQueue);
+  create_image_view(device, texture->Image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, texture->MipLevels, deletionQueue, VK_IMAGE_USAGE_SAMPLED_BIT);
 
-  texture->Sampler = create_texture_sampler(device, texture->MipLevels);
+  texture->Sampler = create_texture_sampler(device);
 
   if (deletionQueue)
   {
     deletionQueue->PushFunction([=]{
-      vkDestroySampler(device.LogicalDevice, texture->Sampler, nullptr);
       vkDestroyImage(device.LogicalDevice, texture->Image.Src, nullptr);
-      vkFreeMemory(device.LogicalDevice, texture->Image.Memory, nullptr);
+      memory::release(texture->Image.Allocation);
     });
   }
 
@@ -1663,8 +1968,7 @@ create_depth_resources(
   create_image_view(device, depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1, deletionQueue);
 
   transition_image_layout(
-    device,
-    commandPool,
+    upload::graphics_cmd(),
     depthImage.Src,
     depthFormat,
     VK_IMAGE_LAYOUT_UNDEFINED,
@@ -1674,8 +1978,9 @@ create_depth_resources(
 
   if (deletionQueue)
   deletionQueue->PushFunction([=]{
+    stAllocation allocation = depthImage.Allocation;
     vkDestroyImage(device.LogicalDevice, depthImage.Src, nullptr);
-    vkFreeMemory(device.LogicalDevice, depthImage.Memory, nullptr);
+    memory::release(allocation);
   });
 
   return depthImage;
@@ -1708,53 +2013,53 @@ create_color_resources(
   if (deletionQueue)
   deletionQueue->PushFunction([=]{
     vkDestroyImageView(device.LogicalDevice, colorImage.View, nullptr);
+    stAllocation allocation = colorImage.Allocation;
     vkDestroyImage(device.LogicalDevice, colorImage.Src, nullptr);
-    vkFreeMemory(device.LogicalDevice, colorImage.Memory, nullptr);
+    memory::release(allocation);
   });
 
   return colorImage;
 }
 
+// device local buffer, filled by the next upload batch
 stBuffer
-create_vertex_buffer(
+create_device_buffer(
   const stDevice& device,
   VkCommandPool commandPool,
-  stMesh& mesh,
+  const void* source,
+  VkDeviceSize bufferSize,
+  VkBufferUsageFlags usage,
   stDeletionQueue* deletionQueue = nullptr)
 {
   stBuffer buffer = {};
 
-  VkDeviceSize bufferSize = sizeof(mesh.Vertices[0]) * mesh.Vertices.size();
-
-  stBuffer stagingBuffer = {};
-  init::create_buffer(
-    device,
-    bufferSize,
-    VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, nullptr
-  );
-
-  void* data;
-  vkMapMemory(device.LogicalDevice, stagingBuffer.Memory, 0, bufferSize, 0, &data);
-    memcpy(data, mesh.Vertices.data(), (size_t) bufferSize);
-  vkUnmapMemory(device.LogicalDevice, stagingBuffer.Memory);
-
   init::create_buffer(
     device,
     bufferSize,
-    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer,
     deletionQueue
   );
 
-  init::copy_buffer(device, stagingBuffer.Buffer, buffer.Buffer, bufferSize, commandPool);
-
-  vkDestroyBuffer(device.LogicalDevice, stagingBuffer.Buffer, nullptr);
-  vkFreeMemory(device.LogicalDevice, stagingBuffer.Memory, nullptr);
+  upload::buffer(buffer.Buffer, 0, source, bufferSize);
+  upload::release_buffer(buffer.Buffer, 0, bufferSize);
 
   return buffer;
 }
 
+stBuffer
+create_vertex_buffer(
+  const stDevice& device,
+  VkCommandPool commandPool,
+  stMesh& mesh,
+  stDeletionQueue* deletionQueue = nullptr,
+  VkBufferUsageFlags extraUsage = 0)
+{
+  VkDeviceSize bufferSize = sizeof(mesh.Vertices[0]) * mesh.Vertices.size();
+
+  return create_device_buffer(device, commandPool, mesh.Vertices.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | extraUsage, deletionQueue);
+}
+
 stBuffer
 create_index_buffer(
   const stDevice& device,
@@ -1762,36 +2067,9 @@ create_index_buffer(
   stMesh& mesh,
   stDeletionQueue* deletionQueue = nullptr)
 {
-  stBuffer buffer = {};
-
   VkDeviceSize bufferSize = sizeof(mesh.Indices[0]) * mesh.Indices.size();
 
-  stBuffer stagingBuffer = {};
-  init::create_buffer(
-    device,
-    bufferSize,
-    VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, nullptr
-  );
-
-  void* data;
-  vkMapMemory(device.LogicalDevice, stagingBuffer.Memory, 0, bufferSize, 0, &data);
-    memcpy(data, mesh.Indices.data(), (size_t) bufferSize);
-  vkUnmapMemory(device.LogicalDevice, stagingBuffer.Memory);
-
-  init::create_buffer(
-    device,
-    bufferSize,
-    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, deletionQueue
-  );
-
-  init::copy_buffer(device, stagingBuffer.Buffer, buffer.Buffer, bufferSize, commandPool);
-
-  vkDestroyBuffer(device.LogicalDevice, stagingBuffer.Buffer, nullptr);
-  vkFreeMemory(device.LogicalDevice, stagingBuffer.Memory, nullptr);
-
-  return buffer;
+  return create_device_buffer(device, commandPool, mesh.Indices.data(), bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, deletionQueue);
 }
 
 //stBuffer
@@ -0,0 +1,411 @@
+
+// ############################################################################
+// # gpu memory
+// ############################################################################
+
+// Buffers and images are sub-allocated from large VkDeviceMemory blocks
+// instead of one vkAllocateMemory each. Every memory type gets a pool per
+// category, so buffers and optimal images never share a block and
+// bufferImageGranularity can be ignored. Blocks of host visible types stay
+// mapped for their whole life.
+enum
+enMemoryCategory
+{
+  MEMORY_CATEGORY_BUFFER = 0,
+  MEMORY_CATEGORY_STAGING = 1,
+  MEMORY_CATEGORY_IMAGE = 2,
+  MEMORY_CATEGORY_ATTACHMENT = 3,
+  MEMORY_CATEGORY_COUNT = 4
+};
+
+struct
+stAllocation
+{
+  VkDeviceMemory Memory = VK_NULL_HANDLE;
+  VkDeviceSize Offset = 0;
+  VkDeviceSize Size = 0;
+  uint8_t* Mapped = nullptr; // at Offset, null unless the memory is host visible
+  uint32_t Pool = UINT32_MAX;
+  uint32_t Block = 0;
+};
+
+struct
+stMemoryStats
+{
+  uint32_t BlockCount = 0;
+  uint32_t AllocationCount = 0;
+  VkDeviceSize BlockBytes = 0;
+  VkDeviceSize UsedBytes = 0;
+};
+
+// first fit free list over [0, Capacity), the alignment padding in front
+// of an allocation stays a free range
+struct
+stRangeAllocator
+{
+  struct
+  stFreeRange
+  {
+    VkDeviceSize Offset = 0;
+    VkDeviceSize Size = 0;
+  };
+
+  void
+  Init(
+    VkDeviceSize capacity)
+  {
+    Capacity = capacity;
+    FreeRanges.assign(1, { 0, capacity });
+  }
+
+  bool
+  Allocate(
+    VkDeviceSize size,
+    VkDeviceSize alignment,
+    VkDeviceSize* offset)
+  {
+    for (size_t i = 0; i < FreeRanges.size(); i++)
+    {
+      stFreeRange range = FreeRanges[i];
+
+      VkDeviceSize aligned = (range.Offset + alignment - 1) / alignment * alignment;
+      if (aligned + size > range.Offset + range.Size)
+      {
+        continue;
+      }
+
+      VkDeviceSize end = aligned + size;
+      FreeRanges.erase(FreeRanges.begin() + i);
+
+      if (end < range.Offset + range.Size)
+      {
+        FreeRanges.insert(FreeRanges.begin() + i, { end, range.Offset + range.Size - end });
+      }
+      if (aligned > range.Offset)
+      {
+        FreeRanges.insert(FreeRanges.begin() + i, { range.Offset, aligned - range.Offset });
+      }
+
+      *offset = aligned;
+      return true;
+    }
+
+    return false;
+  }
+
+  void
+  Free(
+    VkDeviceSize offset,
+    VkDeviceSize size)
+  {
+    size_t i = 0;
+    while (i < FreeRanges.size() && FreeRanges[i].Offset < offset)
+    {
+      i++;
+    }
+    FreeRanges.insert(FreeRanges.begin() + i, { offset, size });
+
+    if (i + 1 < FreeRanges.size() && FreeRanges[i].Offset + FreeRanges[i].Size == FreeRanges[i + 1].Offset)
+    {
+      FreeRanges[i].Size += FreeRanges[i + 1].Size;
+      FreeRanges.erase(FreeRanges.begin() + i + 1);
+    }
+    if (i > 0 && FreeRanges[i - 1].Offset + FreeRanges[i - 1].Size == FreeRanges[i].Offset)
+    {
+      FreeRanges[i - 1].Size += FreeRanges[i].Size;
+      FreeRanges.erase(FreeRanges.begin() + i);
+    }
+  }
+
+  // adds [Capacity, capacity) as free space
+  void
+  Grow(
+    VkDeviceSize capacity)
+  {
+    assert(capacity > Capacity);
+    Free(Capacity, capacity - Capacity);
+    Capacity = capacity;
+  }
+
+  std::vector<stFreeRange> FreeRanges; // sorted by offset, neighbours merged
+  VkDeviceSize Capacity = 0;
+};
+
+namespace memory
+{
+
+struct
+stMemoryBlock
+{
+  VkDeviceMemory Memory = VK_NULL_HANDLE;
+  VkDeviceSize Size = 0;
+  uint8_t* Mapped = nullptr;
+  stRangeAllocator Ranges;
+  uint32_t AllocationCount = 0;
+  bool Dedicated = false; // holds one allocation larger than half a block
+};
+
+struct
+stMemoryPool
+{
+  uint32_t MemoryType = 0;
+  enMemoryCategory Category = MEMORY_CATEGORY_BUFFER;
+  std::vector<stMemoryBlock> Blocks; // released blocks keep their slot
+};
+
+const char* CategoryNames[MEMORY_CATEGORY_COUNT] = { "buffer", "staging", "image", "attachment" };
+
+VkDeviceSize BlockSizes[MEMORY_CATEGORY_COUNT] =
+{
+  MEMORY_BLOCK_SIZE,
+  MEMORY_STAGING_BLOCK_SIZE,
+  MEMORY_BLOCK_SIZE,
+  MEMORY_BLOCK_SIZE
+};
+
+VkDevice Device = VK_NULL_HANDLE;
+VkPhysicalDeviceMemoryProperties Properties = {};
+std::vector<stMemoryPool> Pools;
+stMemoryStats Stats[MEMORY_CATEGORY_COUNT];
+std::mutex Mutex;
+
+uint32_t
+find_memory_type(
+  uint32_t typeFilter,
+  VkMemoryPropertyFlags properties)
+{
+  for (uint32_t i = 0; i < Properties.memoryTypeCount; i++)
+  {
+    if ((typeFilter & (1 << i)) && (Properties.memoryTypes[i].propertyFlags & properties) == properties)
+    {
+      return i;
+    }
+  }
+
+  assert(false);
+  return 0;
+}
+
+void
+release_block(
+  stMemoryPool& pool,
+  stMemoryBlock& block)
+{
+  // freeing the memory unmaps it
+  vkFreeMemory(Device, block.Memory, nullptr);
+
+  stMemoryStats& stats = Stats[pool.Category];
+  stats.BlockCount--;
+  stats.BlockBytes -= block.Size;
+
+  block = {};
+}
+
+void
+term()
+{
+  for (stMemoryPool& pool : Pools)
+  {
+    for (stMemoryBlock& block : pool.Blocks)
+    {
+      if (block.Memory != VK_NULL_HANDLE)
+      {
+        if (block.AllocationCount > 0)
+        {
+          fprintf(stderr, "Warning: %u %s allocations still alive at shutdown\n", block.AllocationCount, CategoryNames[pool.Category]);
+        }
+        release_block(pool, block);
+      }
+    }
+  }
+
+  Pools.clear();
+}
+
+// call right after creating the device, the deletion queue frees every
+// block just before the device goes away
+void
+init(
+  const stDevice& device,
+  stDeletionQueue* deletionQueue)
+{
+  Device = device.LogicalDevice;
+  vkGetPhysicalDeviceMemoryProperties(device.PhysicalDevice, &Properties);
+
+  if (deletionQueue)
+  deletionQueue->PushFunction([=]{
+    term();
+  });
+}
+
+stAllocation
+allocate(
+  const VkMemoryRequirements& requirements,
+  VkMemoryPropertyFlags properties,
+  enMemoryCategory category)
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+
+  uint32_t memoryType = find_memory_type(requirements.memoryTypeBits, properties);
+
+  uint32_t poolIndex = 0;
+  while (poolIndex < Pools.size() && (Pools[poolIndex].MemoryType != memoryType || Pools[poolIndex].Category != category))
+  {
+    poolIndex++;
+  }
+
+  if (poolIndex == Pools.size())
+  {
+    stMemoryPool pool = {};
+    pool.MemoryType = memoryType;
+    pool.Category = category;
+    Pools.push_back(pool);
+  }
+
+  stMemoryPool& pool = Pools[poolIndex];
+  VkDeviceSize blockSize = BlockSizes[category];
+  bool dedicated = requirements.size > blockSize / 2;
+
+  stAllocation allocation = {};
+  allocation.Pool = poolIndex;
+  allocation.Size = requirements.size;
+
+  uint32_t blockIndex = UINT32_MAX;
+  VkDeviceSize offset = 0;
+
+  if (!dedicated)
+  {
+    for (uint32_t i = 0; i < pool.Blocks.size(); i++)
+    {
+      stMemoryBlock& block = pool.Blocks[i];
+      if (block.Memory != VK_NULL_HANDLE && !block.Dedicated
+        && block.Ranges.Allocate(requirements.size, requirements.alignment, &offset))
+      {
+        blockIndex = i;
+        break;
+      }
+    }
+  }
+
+  if (blockIndex == UINT32_MAX)
+  {
+    stMemoryBlock block = {};
+    block.Size = dedicated ? requirements.size : blockSize;
+    block.Dedicated = dedicated;
+    block.Ranges.Init(block.Size);
+
+    VkMemoryAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+    allocInfo.allocationSize = block.Size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VK_CHECK(vkAllocateMemory(Device, &allocInfo, nullptr, &block.Memory));
+
+    if (Properties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+      VK_CHECK(vkMapMemory(Device, block.Memory, 0, VK_WHOLE_SIZE, 0, (void**)&block.Mapped));
+    }
+
+    bool fits = block.Ranges.Allocate(requirements.size, requirements.alignment, &offset);
+    assert(fits);
+
+    Stats[category].BlockCount++;
+    Stats[category].BlockBytes += block.Size;
+
+    blockIndex = 0;
+    while (blockIndex < pool.Blocks.size() && pool.Blocks[blockIndex].Memory != VK_NULL_HANDLE)
+    {
+      blockIndex++;
+    }
+
+    if (blockIndex == pool.Blocks.size())
+    {
+      pool.Blocks.push_back(block);
+    }
+    else
+    {
+      pool.Blocks[blockIndex] = block;
+    }
+  }
+
+  stMemoryBlock& block = pool.Blocks[blockIndex];
+  block.AllocationCount++;
+
+  allocation.Memory = block.Memory;
+  allocation.Block = blockIndex;
+  allocation.Offset = offset;
+  allocation.Mapped = block.Mapped ? block.Mapped + offset : nullptr;
+
+  Stats[category].AllocationCount++;
+  Stats[category].UsedBytes += allocation.Size;
+
+  return allocation;
+}
+
+void
+release(
+  stAllocation& allocation)
+{
+  if (allocation.Pool == UINT32_MAX)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(Mutex);
+
+  stMemoryPool& pool = Pools[allocation.Pool];
+  stMemoryBlock& block = pool.Blocks[allocation.Block];
+  assert(block.Memory == allocation.Memory);
+
+  block.Ranges.Free(allocation.Offset, allocation.Size);
+
+  stMemoryStats& stats = Stats[pool.Category];
+  stats.AllocationCount--;
+  stats.UsedBytes -= allocation.Size;
+
+  block.AllocationCount--;
+
+  // one empty block per pool is kept around for the next allocation
+  if (block.AllocationCount == 0)
+  {
+    bool keep = !block.Dedicated;
+    for (const stMemoryBlock& other : pool.Blocks)
+    {
+      if (&other != &block && other.Memory != VK_NULL_HANDLE && !other.Dedicated && other.AllocationCount == 0)
+      {
+        keep = false;
+      }
+    }
+
+    if (!keep)
+    {
+      release_block(pool, block);
+    }
+  }
+
+  allocation = {};
+}
+
+stMemoryStats
+get_stats(
+  enMemoryCategory category)
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Stats[category];
+}
+
+void
+print_stats()
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+
+  for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+  {
+    const stMemoryStats& stats = Stats[i];
+    printf("%-10s %4u blocks %8.2f MB, %6u allocations %8.2f MB\n",
+      CategoryNames[i],
+      stats.BlockCount, stats.BlockBytes / (1024.0 * 1024.0),
+      stats.AllocationCount, stats.UsedBytes / (1024.0 * 1024.0));
+  }
+}
+
+}
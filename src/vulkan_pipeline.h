@@ -18,6 +18,7 @@ stPipeline
 	VkPipelineColorBlendAttachmentState ColorBlendAttachment;
 	VkPipelineMultisampleStateCreateInfo Multisampling;
 	VkPipelineLayout PipelineLayout;
+  VkBool32 DepthWrite = VK_TRUE;
 };
 
 VkPipeline
@@ -58,7 +59,7 @@ stPipeline::build_pipeline(
 
   VkPipelineDepthStencilStateCreateInfo depthStencil = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
   depthStencil.depthTestEnable = VK_TRUE;
-  depthStencil.depthWriteEnable = VK_TRUE;
+  depthStencil.depthWriteEnable = DepthWrite;
   depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
   depthStencil.depthBoundsTestEnable = VK_FALSE;
   depthStencil.minDepthBounds = 0.0f; // Optional
@@ -84,7 +85,7 @@ stPipeline::build_pipeline(
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-  VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+  VK_CHECK(vkCreateGraphicsPipelines(device, pipeline_cache::Cache, 1, &pipelineInfo, nullptr, &pipeline));
 
   return pipeline;
 }
\ No newline at end of file
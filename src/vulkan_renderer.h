@@ -86,7 +86,9 @@ enQueueType : int
 {
   QUEUE_TYPE_GRAPHICS = 0,
   QUEUE_TYPE_PRESENT = 0,
-  QUEUE_TYPE_COMPUTE = 1
+  QUEUE_TYPE_COMPUTE = 1,
+  QUEUE_TYPE_TRANSFER = 2, // same family and queue as graphics without a transfer-only family
+  QUEUE_TYPE_COUNT = 3
 };
 
 struct
@@ -102,7 +104,8 @@ stDevice
 {
   VkPhysicalDevice PhysicalDevice = VK_NULL_HANDLE;
   VkDevice LogicalDevice = VK_NULL_HANDLE;
-  stQueue Queues[2] = {};
+  stQueue Queues[QUEUE_TYPE_COUNT] = {};
+  bool MultiDrawIndirect = false; // many indirect draws per call, with firstInstance
 };
 
 struct
@@ -116,6 +119,15 @@ stGfxPipeline
   VkDescriptorSetLayout ObjectLayout = VK_NULL_HANDLE;
 };
 
+struct
+stComputePipeline
+{
+  VkPipeline Pipeline = VK_NULL_HANDLE;
+  VkPipelineLayout Layout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout SetLayout = VK_NULL_HANDLE;
+};
+
+#include "pipeline_cache.h"
 #include "vulkan_pipeline.h"
 
 struct
@@ -125,39 +137,41 @@ stMaterial
 	VkPipelineLayout PipelineLayout;
 };
 
+typedef stHandle<stMaterial> stMaterialHandle;
+
 namespace material
 {
 
-#define MAX_MATERIAL_COUNT 1024
-stMaterial Materials[MAX_MATERIAL_COUNT];
-uint32_t MaterialsCount = 0;
+stResourceTable<stMaterial, 64> Materials;
 
-std::unordered_map<std::string, stMaterial*> CachedMaterials;
+std::unordered_map<std::string, stMaterialHandle> CachedMaterials;
 
-stMaterial* create_material(
+stMaterialHandle create_material(
   VkPipeline pipeline,
   VkPipelineLayout layout,
   const char* name)
 {
-  stMaterial* mat;
+  stMaterialHandle handle;
   if (CachedMaterials.find(name) != CachedMaterials.end())
   {
-    mat = CachedMaterials[name];
+    handle = CachedMaterials[name];
   }
   else
   {
-    mat = &Materials[MaterialsCount++];
-    CachedMaterials[name] = mat;
+    handle = Materials.Create();
+    CachedMaterials[name] = handle;
   }
+  stMaterial* mat = Materials.Get(handle);
   mat->Pipeline = pipeline;
   mat->PipelineLayout = layout;
-  return mat;
+  return handle;
 }
 
-stMaterial* get_material(
+stMaterialHandle get_material(
   const char* name)
 {
-  return CachedMaterials[name];
+  auto it = CachedMaterials.find(name);
+  return it != CachedMaterials.end() ? it->second : stMaterialHandle{};
 }
 
 }
@@ -165,26 +179,54 @@ stMaterial* get_material(
 struct
 stRenderObject
 {
-  stMesh* Mesh;
-  stMaterial* Material;
+  mesh::stMeshHandle Mesh;
+  stMaterialHandle Material;
   glm::mat4* Transform;
+  int64_t TransformId = -1;
+  uint32_t DirtyImages = 0; // object buffers still holding an older transform
 };
 
+// consecutive indirect commands that share pipeline and vertex buffer,
+// First and Count are in commands
 struct
 stIndirectBatch
 {
-  stMesh* Mesh;
-  stMaterial* Material;
-  glm::mat4* Transform;
-  //
-  uint32_t First;
-  uint32_t Count;
+  stMaterial* Material = nullptr;
+  VkBuffer Vertices = VK_NULL_HANDLE;
+  uint32_t First = 0;
+  uint32_t Count = 0;
+  uint32_t Objects = 0; // instances across the commands
 };
 
 struct
 stPerObjectDataGPU
 {
   alignas(16) glm::mat4 Model;
+  uint32_t MaterialIndex;
+  uint32_t TextureIndex; // base color, in the bindless texture array
+  alignas(16) glm::vec4 Sphere; // bounding sphere in mesh space, center and radius
+};
+
+#define MATERIAL_NO_TEXTURE 0xFFFFFFFF
+
+// one entry of the material table, texture members are texture slots
+struct
+stMaterialDataGPU
+{
+  alignas(16) glm::vec4 BaseColorFactor;
+  alignas(16) glm::vec4 EmissiveFactor; // w: alpha cutoff
+  float MetallicFactor;
+  float RoughnessFactor;
+  float NormalScale;
+  float OcclusionStrength;
+  uint32_t BaseColorTexture;
+  uint32_t MetallicRoughnessTexture;
+  uint32_t NormalTexture;
+  uint32_t OcclusionTexture;
+  uint32_t EmissiveTexture;
+  uint32_t AlphaMode;
+  uint32_t DoubleSided;
+  uint32_t Padding;
 };
 
 struct
@@ -194,11 +236,13 @@ stGlobalDataGPU
   alignas(16) glm::vec3 DirectionalLight;
 };
 
+#include "vulkan_memory.h"
+
 struct
 stBuffer
 {
   VkBuffer Buffer = VK_NULL_HANDLE;
-  VkDeviceMemory Memory = VK_NULL_HANDLE;
+  stAllocation Allocation = {};
 };
 
 struct
@@ -206,7 +250,7 @@ stImage
 {
   VkImage Src = VK_NULL_HANDLE;
   VkImageView View = VK_NULL_HANDLE;
-  VkDeviceMemory Memory = VK_NULL_HANDLE;
+  stAllocation Allocation = {};
 };
 
 struct
@@ -214,10 +258,12 @@ stTexture
 {
   stImage Image = {};
   VkSampler Sampler = VK_NULL_HANDLE;
-  uint32_t DescriptorSetIndex = 0;
+  uint32_t DescriptorIndex = 0;
   uint32_t MipLevels;
 };
 
+typedef stHandle<stTexture> stTextureHandle;
+
 VkSurfaceKHR
 CreateSurface(
   VkInstance instance,
@@ -230,11 +276,21 @@ ChooseSwapExtent(
   const VkSurfaceCapabilitiesKHR& capabilities
 );
 
+#define MAX_PHYSICAL_DEVICE_COUNT 16
+#define MAX_SWAPCHAIN_IMAGE_COUNT 16
+
+#include "upload.h"
+#include "downsample.h"
+#include "deferred_release.h"
 #include "vulkan_initializers.h"
 #include "vulkan_shaders.h"
 
-#define MAX_PHYSICAL_DEVICE_COUNT 16
-#define MAX_SWAPCHAIN_IMAGE_COUNT 16
+#include "texture_streaming.h"
+#include "morph_targets.h"
+#include "skinning.h"
+#include "culling.h"
+#include "geometry_arena.h"
+#include "render_queue.h"
 
 struct
 stRenderer
@@ -260,55 +316,112 @@ stRenderer
   void
   Render(double delta = 0.0f);
 
-  std::vector<stIndirectBatch>
-  CompactDraws(
-    stRenderObject* objects,
-    uint32_t count)
-  {
-    std::vector<stIndirectBatch> draws;
+  void
+  RemoveRenderingObjects(
+    stScene& scene);
 
-    auto addToDraws =
-      [&draws](stMesh* mesh,
-               stMaterial* material)
-    {
-      stIndirectBatch firstDraw;
-      firstDraw.Mesh = mesh;
-      firstDraw.Material = material;
-      firstDraw.First = 0;
-      firstDraw.Count = 1;
+  void
+  WriteObjectBuffers();
 
-      draws.push_back(firstDraw);
-    };
+  void
+  UpdateObjectBuffer(
+    uint32_t imageIndex);
 
-    addToDraws(objects[0].Mesh, objects[0].Material);
+  void
+  CreateObjectBuffers(
+    uint32_t capacity);
 
-    for (uint32_t i = 0; i < count; i++)
-    {
-      bool sameMesh = objects->Mesh == draws.back().Mesh;
-      bool sameMaterial = objects->Material == draws.back().Material;
+  void
+  DestroyObjectBuffers();
 
-      if (sameMesh && sameMaterial)
-      {
-        draws.back().Count++;
-      }
-      else
-      {
-        addToDraws(objects[i].Mesh, objects[i].Material);
-      }
-    }
+  void
+  ReserveObjects(
+    uint64_t count);
 
-    return draws;
-  }
+  void
+  WriteObjectDescriptors(
+    uint32_t imageIndex);
 
   void
-  DrawObjects(
+  UpdateObjectBounds(
+    uint32_t object);
+
+  // fills ObjectVisible for every render object on the job system
+  void
+  CullObjects(
+    const glm::mat4& viewProj);
+
+  void
+  ReleaseRenderMesh(
+    uint32_t slot);
+
+  void
+  ReleaseUnloadedMeshes();
+
+  stTexture
+  LoadTexture(
+    const std::string& path);
+
+  uint32_t
+  AddMaterial(
+    const stMesh& mesh,
+    uint32_t baseColorTexture);
+
+  void
+  UploadMaterials();
+
+  stMaterialHandle
+  GetSurfacePipeline(
+    const char* materialName,
+    uint32_t materialIndex);
+
+  void
+  WriteTextureDescriptor(
+    uint32_t textureIndex);
+
+  void
+  RequestTextureMips();
+
+  void
+  SetMorphWeights(
+    mesh::stMeshHandle mesh,
+    const float* weights,
+    uint32_t count);
+
+  uint64_t
+  DrawKey(
+    const stRenderObject& object,
+    uint32_t pass,
+    float depth);
+
+  void
+  QueueDraws(
+    stRenderObject* first,
+    uint32_t count);
+
+  void
+  CompactDraws(
+    stRenderObject* first,
+    uint32_t firstObject,
+    const std::vector<stRenderQueueItem>& items,
+    const uint8_t* visible);
+
+  // culls the objects and refreshes the draws of the image, outside of a
+  // render pass; the sorted queue and the opaque commands are cached until
+  // DrawsDirty is set
+  void
+  PrepareDraws(
     VkCommandBuffer cmd,
     uint32_t targetIndex,
-    VkDescriptorSet descriptorSets[MAX_TEXTURE_COUNT][MAX_SWAPCHAIN_IMAGE_COUNT],
-    uint32_t descriptorSetCount,
     stRenderObject* first,
     uint32_t count);
 
+  void
+  DrawObjects(
+    VkCommandBuffer cmd,
+    uint32_t targetIndex,
+    VkDescriptorSet textureSet);
+
   VkInstance Instance = VK_NULL_HANDLE;
   VkSurfaceKHR Surface = VK_NULL_HANDLE;
 
@@ -329,24 +442,87 @@ stRenderer
   struct
   stRenderMeshData
   {
-    stBuffer VertexBuffer = {};
-    stBuffer IndexBuffer = {};
+    stGeometryRange Geometry = {}; // indices, and vertices unless the mesh is deformed
+    stBuffer VertexBuffer = {}; // source of the morph and skinning passes, deformed meshes only
     stTexture TexImage = {};
+    stBuffer DeformedVertices = {}; // morphed and/or skinned, drawn instead of arena vertices when set
+    uint32_t MaterialIndex = 0;
+    glm::vec4 Sphere = glm::vec4(0.0f); // of the mesh, center and radius
+    mesh::stMeshHandle Mesh;
   };
 
-  stRenderMeshData RenderMeshes[MAX_MESH_COUNT];
-  //stRenderMeshData *RenderMeshes = (stRenderMeshData*) calloc(MAX_MESH_COUNT, sizeof(stRenderMeshData));
+  // indexed by mesh slot, valid while Mesh matches the handle asked for
+  std::vector<stRenderMeshData> RenderMeshes;
+  uint32_t SeenMeshFrees = 0; // mesh::Meshes.Frees when RenderMeshes were last checked
 
-  std::unordered_map<stMesh*, stRenderMeshData*> RenderMeshesCache;
+  stRenderMeshData*
+  GetRenderMesh(
+    mesh::stMeshHandle handle)
+  {
+    if (handle.Index >= RenderMeshes.size() || RenderMeshes[handle.Index].Mesh != handle)
+    {
+      return nullptr;
+    }
+    return &RenderMeshes[handle.Index];
+  }
 
   VkDescriptorPool DescriptorPool = VK_NULL_HANDLE;
-  VkDescriptorSet TextureSets[MAX_TEXTURE_COUNT][MAX_SWAPCHAIN_IMAGE_COUNT]; // TODO: define image count
-
-  stBuffer ObjectBuffers[MAX_SWAPCHAIN_IMAGE_COUNT];
+  VkDescriptorPool TexturePool = VK_NULL_HANDLE;
+  VkDescriptorSet TextureSets[MAX_SWAPCHAIN_IMAGE_COUNT] = {}; // bindless, one per image so streaming can swap images per frame
+
+  // one per swapchain image, they outlive swapchain recreation unless the
+  // image count changes
+  stBuffer ObjectBuffers[MAX_SWAPCHAIN_IMAGE_COUNT] = {};
+  stBuffer IndirectBuffers[MAX_SWAPCHAIN_IMAGE_COUNT] = {}; // a draw command per object at most
+  stBuffer InstanceBuffers[MAX_SWAPCHAIN_IMAGE_COUNT] = {}; // object of every instance, read through gl_InstanceIndex
+  stBuffer CullBuffers[MAX_SWAPCHAIN_IMAGE_COUNT] = {}; // stCullRecordGPU per queued object, with GpuCulling
+  uint32_t ObjectBufferCount = 0;
+  uint32_t ObjectCapacity = OBJECT_BUFFER_INITIAL_CAPACITY;
   VkDescriptorSet ObjectDescriptors[MAX_SWAPCHAIN_IMAGE_COUNT];
+  uint32_t StaleObjectDescriptors = 0; // swapchain images whose object set names replaced buffers
+
+  // material table, entry 0 is the default material
+  std::vector<stMaterialDataGPU> MaterialData;
+  std::unordered_map<std::string, uint32_t> MaterialIndices; // stSurfaceMaterial::Name -> entry
+  stBuffer MaterialBuffer = {};
+  size_t UploadedMaterialCount = 0;
 
   stTexture DefaultTexImage = {};
 
+  stTextureStreamer TextureStreamer;
+
+  stMorphPass MorphPass;
+  stSkinningPass SkinningPass;
+
+  stGeometryArena Geometry;
+
+  // opaque and masked draws, sorted when DrawsDirty is set; blended ones
+  // are sorted back to front every frame
+  stRenderQueue RenderQueue;
+  stRenderQueue BlendQueue;
+  bool DrawsDirty = true; // objects, materials or pipelines changed
+  bool DrawsCompacted = false; // the first Cached* entries hold RenderQueue
+  uint32_t StaleDrawImages = 0; // swapchain images without the cached records
+
+  std::vector<VkDrawIndexedIndirectCommand> IndirectCommands;
+  std::vector<stIndirectBatch> IndirectBatches;
+  std::vector<stCullRecordGPU> CullRecords;
+  size_t CachedCommandCount = 0;
+  size_t CachedBatchCount = 0;
+  size_t CachedRecordCount = 0;
+
+  stCullingPass CullingPass;
+  bool GpuCulling = false; // the culling pass fills instance counts, needs MultiDrawIndirect
+
+  // world bounds and CPU culling results, indexed like RenderObjects
+  stSphereBoundsSoA ObjectBounds;
+  std::vector<uint8_t> ObjectVisible;
+
+  // CULLING_VALIDATE: queued objects the CPU culler kept and indirect
+  // commands recorded for each image, checked once its fence is waited
+  uint32_t ExpectedVisible[MAX_SWAPCHAIN_IMAGE_COUNT] = {};
+  uint32_t ValidateCommands[MAX_SWAPCHAIN_IMAGE_COUNT] = {};
+
   VkSampleCountFlagBits SamplesFlag = VK_SAMPLE_COUNT_1_BIT;
 
   stImage SwapchainImages[MAX_SWAPCHAIN_IMAGE_COUNT];
@@ -370,9 +546,14 @@ stRenderer
 
   stCamera* Camera;
   stSun* Sun;
+  stAnimationSystem* Animation = nullptr;
+  stTransformSystem* Transforms = nullptr;
+  stJobSystem* Jobs = nullptr; // runs the CPU culler, inline without one
 
   uint64_t RenderObjectCount = 0;
   std::vector<stRenderObject> RenderObjects;
+  std::unordered_multimap<int64_t, uint32_t> ObjectsByTransform; // transform id -> RenderObjects index
+  std::vector<uint32_t> DirtyObjects; // RenderObjects with DirtyImages set
 };
 
 void
@@ -408,6 +589,16 @@ stRenderer::Init(
 
   Device = init::create_device(Device.PhysicalDevice, Surface, &Deletion);
 
+  memory::init(Device, &Deletion);
+  upload::init(Device, &Deletion);
+  deferred::init(Device, &Deletion);
+  pipeline_cache::init(Device, &Deletion);
+
+  // textures share the cached samplers, they go after every texture
+  Deletion.PushFunction([=]{
+    init::destroy_samplers(Device);
+  });
+
   for (size_t i = 0; i < SwapchainImageCount; i++)
   {
     AcquireSemaphores[i] = init::create_semaphore(Device, &Deletion);
@@ -417,10 +608,58 @@ stRenderer::Init(
 
   CommandPool = init::create_command_pool(Device, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, &Deletion);
 
+  Geometry.Init(Device, &Deletion);
+
+  downsample::init(
+    Device,
+    init::create_compute_pipeline(
+      Device,
+      "./data/shaders/downsample.comp.spv",
+      downsample::Bindings,
+      ArrayCount(downsample::Bindings),
+      sizeof(downsample::stConstantsGPU),
+      &Deletion
+    ),
+    &Deletion
+  );
+
   RenderObjects.reserve(1000000);
 
   DefaultTexImage = init::create_texture(Device, CommandPool, "./data/models/cube/default.png", &Deletion);
 
+  {
+    stMaterialDataGPU defaultMaterial = {};
+    defaultMaterial.BaseColorFactor = glm::vec4(1.0f);
+    defaultMaterial.EmissiveFactor = glm::vec4(0.0f, 0.0f, 0.0f, 0.5f);
+    defaultMaterial.MetallicFactor = 1.0f;
+    defaultMaterial.RoughnessFactor = 1.0f;
+    defaultMaterial.NormalScale = 1.0f;
+    defaultMaterial.OcclusionStrength = 1.0f;
+    defaultMaterial.BaseColorTexture = DefaultTexImage.DescriptorIndex;
+    defaultMaterial.MetallicRoughnessTexture = MATERIAL_NO_TEXTURE;
+    defaultMaterial.NormalTexture = MATERIAL_NO_TEXTURE;
+    defaultMaterial.OcclusionTexture = MATERIAL_NO_TEXTURE;
+    defaultMaterial.EmissiveTexture = MATERIAL_NO_TEXTURE;
+    defaultMaterial.AlphaMode = ALPHA_MODE_OPAQUE;
+
+    MaterialData.push_back(defaultMaterial);
+    UploadMaterials();
+  }
+
+  TextureStreamer.Init(Device);
+
+  MorphPass.Init(Device, CommandPool, &Deletion);
+
+  SkinningPass.Init(Device, CommandPool, &Deletion);
+
+#if GPU_CULLING
+  GpuCulling = Device.MultiDrawIndirect;
+  if (GpuCulling)
+  {
+    CullingPass.Init(Device, &Deletion);
+  }
+#endif
+
   CreateSwapchain();
 }
 
@@ -429,69 +668,480 @@ stRenderer::AddRenderingObjectsFromEntities(
   stScene& scene,
   const char* materialName /*= "default"*/)
 {
-  
-  for (size_t i = 0; i < scene.Entities.size(); i++)
+  // meshes first, render objects pick their pipeline from the mesh material
+  {
+    ReleaseUnloadedMeshes();
+    RenderMeshes.resize(mesh::Meshes.Capacity());
+
+    for (uint32_t i = 0; i < mesh::Meshes.Capacity(); i++)
+    {
+      mesh::stMeshHandle handle = mesh::Meshes.HandleOf(i);
+
+      if (!mesh::Meshes.IsAlive(i) || RenderMeshes[i].Mesh == handle)
+      {
+        continue;
+      }
+
+      stMesh& sourceMesh = mesh::Meshes.Slot(i);
+      RenderMeshes[i].Mesh = handle;
+
+      // deformed meshes keep their own vertex buffer as the passes' source,
+      // binding it at an arena offset would need storage buffer alignment
+      bool deformed = sourceMesh.MorphTargetCount > 0 || !sourceMesh.SkinVertices.empty();
+
+      RenderMeshes[i].Geometry = Geometry.Add(sourceMesh, !deformed);
+
+      RenderMeshes[i].VertexBuffer = {};
+      if (deformed)
+      {
+        RenderMeshes[i].VertexBuffer = init::create_vertex_buffer(Device, CommandPool, sourceMesh, nullptr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      }
+
+      // morph first, then skin whatever the morph pass produced
+      RenderMeshes[i].DeformedVertices = {};
+      if (sourceMesh.MorphTargetCount > 0)
+      {
+        RenderMeshes[i].DeformedVertices = MorphPass.Add(handle, sourceMesh, RenderMeshes[i].VertexBuffer);
+      }
+
+      uint32_t animator = !sourceMesh.SkinVertices.empty() && Animation
+        ? Animation->FindOrCreateAnimator(sourceMesh.Skeleton)
+        : ANIMATOR_NONE;
+
+      if (animator != ANIMATOR_NONE)
+      {
+        stBuffer source = RenderMeshes[i].DeformedVertices.Buffer != VK_NULL_HANDLE
+          ? RenderMeshes[i].DeformedVertices
+          : RenderMeshes[i].VertexBuffer;
+
+        RenderMeshes[i].DeformedVertices = SkinningPass.Add(handle, sourceMesh, source, animator);
+      }
+
+      // a skin without an animator draws its bind pose
+      if (deformed && RenderMeshes[i].DeformedVertices.Buffer == VK_NULL_HANDLE)
+      {
+        RenderMeshes[i].DeformedVertices = RenderMeshes[i].VertexBuffer;
+      }
+
+      RenderMeshes[i].Sphere = sourceMesh.Sphere;
+
+      std::string load_texture = sourceMesh.TexturePath.empty()
+        ? "./data/models/cube/default.png"
+        : sourceMesh.TexturePath;
+
+      RenderMeshes[i].TexImage = LoadTexture(load_texture);
+
+      RenderMeshes[i].MaterialIndex = AddMaterial(sourceMesh, RenderMeshes[i].TexImage.DescriptorIndex);
+    }
+  }
+
+  if (MaterialData.size() != UploadedMaterialCount)
   {
-    for (size_t j = 0; j < scene.Entities[i].Entity->MeshCount; j++)
+    UploadMaterials();
+  }
+
+  std::vector<stEntityBase> entities = scene.Entities;
+  entities.insert(entities.end(), scene.Batches.begin(), scene.Batches.end());
+
+  for (size_t i = 0; i < entities.size(); i++)
+  {
+    for (size_t j = 0; j < entities[i].Entity->Meshes.Count; j++)
     {
-      *scene.Entities[i].Entity->Transform.Tramsform *= scene.Entities[i].Entity->Mesh[j]->RootMatrix;
+      mesh::stMeshHandle meshHandle = mesh::get_asset_mesh(entities[i].Entity->Meshes, (uint32_t)j);
+      stMesh* entityMesh = mesh::get_mesh(meshHandle);
+
+      if (!entityMesh)
+      {
+        continue;
+      }
+
+      *entities[i].Entity->Transform.Tramsform *= entityMesh->RootMatrix;
 
-      RenderObjects.push_back({ scene.Entities[i].Entity->Mesh[j], material::get_material(materialName), scene.Entities[i].Entity->Transform.Tramsform });
+      stMaterialHandle pipeline = GetSurfacePipeline(materialName, RenderMeshes[meshHandle.Index].MaterialIndex);
+
+      RenderObjects.push_back({ meshHandle, pipeline, entities[i].Entity->Transform.Tramsform, entities[i].Id });
       // RenderObjects[RenderObjectCount] = { base_entities[i].Entity->Mesh[j], material::get_material(materialName), base_entities[i].Entity->Transform.Tramsform };
 
       RenderObjectCount += 1;
     }
   }
 
+  ReserveObjects(RenderObjectCount);
+}
+
+// gives back everything the render mesh in slot owns; frames in flight may
+// still draw it, so it all goes through the deferred buckets
+void
+stRenderer::ReleaseRenderMesh(
+  uint32_t slot)
+{
+  stRenderMeshData& renderMesh = RenderMeshes[slot];
+
+  Geometry.Remove(renderMesh.Geometry);
+
+  if (renderMesh.VertexBuffer.Buffer != VK_NULL_HANDLE)
+  {
+    deferred::buffer(renderMesh.VertexBuffer);
+  }
+
+  // the passes own the deformed vertices
+  MorphPass.Remove(renderMesh.Mesh);
+  SkinningPass.Remove(renderMesh.Mesh);
+
+  renderMesh = {};
+}
+
+// releases the render meshes whose mesh was freed since the last check
+void
+stRenderer::ReleaseUnloadedMeshes()
+{
+  if (SeenMeshFrees == mesh::Meshes.Frees)
+  {
+    return;
+  }
+
+  for (uint32_t i = 0; i < RenderMeshes.size(); i++)
+  {
+    if (RenderMeshes[i].Mesh.Index != UINT32_MAX && !mesh::get_mesh(RenderMeshes[i].Mesh))
+    {
+      ReleaseRenderMesh(i);
+      DrawsDirty = true;
+    }
+  }
+
+  SeenMeshFrees = mesh::Meshes.Frees;
+}
+
+// loads the texture on first use, returns a copy of its slot
+stTexture
+stRenderer::LoadTexture(
+  const std::string& path)
+{
+  if (stTexture* texture = init::get_texture(path))
+  {
+    return *texture;
+  }
+
+#if TEXTURE_STREAMING
+  stTexture* streamed = TextureStreamer.Load(path.c_str());
+  if (!streamed)
+  {
+    return DefaultTexImage;
+  }
+  stTexture texture = *streamed;
+#else
+  stTexture texture = init::create_texture(Device, CommandPool, path.c_str(), &Deletion);
+#endif
+
+  WriteTextureDescriptor(texture.DescriptorIndex);
+  return texture;
+}
+
+// table entry of the mesh's glTF material, primitives sharing a material
+// share the entry; meshes without one use the default material
+uint32_t
+stRenderer::AddMaterial(
+  const stMesh& mesh,
+  uint32_t baseColorTexture)
+{
+  const stSurfaceMaterial& surface = mesh.Surface;
+
+  if (surface.Name.empty())
+  {
+    return 0;
+  }
+
+  auto it = MaterialIndices.find(surface.Name);
+  if (it != MaterialIndices.end())
+  {
+    return it->second;
+  }
+
+  stMaterialDataGPU data = {};
+  data.BaseColorFactor = surface.BaseColorFactor;
+  data.EmissiveFactor = glm::vec4(surface.EmissiveFactor, surface.AlphaCutoff);
+  data.MetallicFactor = surface.MetallicFactor;
+  data.RoughnessFactor = surface.RoughnessFactor;
+  data.NormalScale = surface.NormalScale;
+  data.OcclusionStrength = surface.OcclusionStrength;
+  data.BaseColorTexture = baseColorTexture;
+  data.AlphaMode = surface.AlphaMode;
+  data.DoubleSided = surface.DoubleSided ? 1 : 0;
+
+  uint32_t* textures[SURFACE_TEXTURE_COUNT] =
+  {
+    &data.MetallicRoughnessTexture,
+    &data.NormalTexture,
+    &data.OcclusionTexture,
+    &data.EmissiveTexture
+  };
+
+  for (uint32_t t = 0; t < SURFACE_TEXTURE_COUNT; t++)
+  {
+    *textures[t] = surface.Textures[t].empty()
+      ? MATERIAL_NO_TEXTURE
+      : LoadTexture(surface.Textures[t]).DescriptorIndex;
+  }
+
+  uint32_t index = (uint32_t)MaterialData.size();
+  MaterialData.push_back(data);
+  MaterialIndices[surface.Name] = index;
+  return index;
+}
+
+// replaces the material buffer; the frames in flight keep the old one
+// until their fences are waited, every image rewrites its object set
+// before it records again
+void
+stRenderer::UploadMaterials()
+{
+  if (MaterialBuffer.Buffer != VK_NULL_HANDLE)
+  {
+    deferred::buffer(MaterialBuffer);
+  }
+
+  MaterialBuffer = init::create_device_buffer(
+    Device,
+    CommandPool,
+    MaterialData.data(),
+    sizeof(stMaterialDataGPU) * MaterialData.size(),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+  );
+
+  UploadedMaterialCount = MaterialData.size();
+  StaleObjectDescriptors = (1u << SwapchainImageCount) - 1;
+  DrawsDirty = true;
+}
+
+// blended and double sided surfaces need their own pipeline variant,
+// custom materials without variants fall back to the plain one
+stMaterialHandle
+stRenderer::GetSurfacePipeline(
+  const char* materialName,
+  uint32_t materialIndex)
+{
+  const stMaterialDataGPU& data = MaterialData[materialIndex];
+
+  std::string name = materialName;
+  if (data.AlphaMode == ALPHA_MODE_BLEND)
+  {
+    name += "_blend";
+  }
+  if (data.DoubleSided)
+  {
+    name += "_double_sided";
+  }
+
+  stMaterialHandle handle = material::get_material(name.c_str());
+  return material::Materials.Get(handle) ? handle : material::get_material(materialName);
+}
+
+// drops render objects of the scene's entities, call before stScene::Unload
+// releases their transforms
+void
+stRenderer::RemoveRenderingObjects(
+  stScene& scene)
+{
+  std::set<glm::mat4*> transforms;
+  for (stEntityBase& base : scene.Entities)
+  {
+    transforms.insert(base.Entity->Transform.Tramsform);
+  }
+  for (stEntityBase& base : scene.Batches)
+  {
+    transforms.insert(base.Entity->Transform.Tramsform);
+  }
+
+  RenderObjects.erase(
+    std::remove_if(RenderObjects.begin(), RenderObjects.end(),
+      [&transforms](const stRenderObject& object)
+      {
+        return transforms.count(object.Transform) != 0;
+      }),
+    RenderObjects.end());
+  RenderObjectCount = RenderObjects.size();
+
+  ReserveObjects(RenderObjectCount);
+}
+
+void
+stRenderer::WriteObjectBuffers()
+{
   for (size_t i = 0; i < SwapchainImageCount; i++)
   {
-    void* objectData;
-    vkMapMemory(Device.LogicalDevice, ObjectBuffers[i].Memory, 0, sizeof(stPerObjectDataGPU) * MAX_OBJECTS_COUNT, 0, &objectData);
-      stPerObjectDataGPU* objectSSBO = (stPerObjectDataGPU*)objectData;
+    stPerObjectDataGPU* objectSSBO = (stPerObjectDataGPU*)ObjectBuffers[i].Allocation.Mapped;
 
       for (int i = 0; i < RenderObjectCount; i++)
       {
       	stRenderObject& object = RenderObjects[i];
+      	stRenderMeshData* renderData = GetRenderMesh(object.Mesh);
       	objectSSBO[i].Model = *object.Transform;
+      	objectSSBO[i].MaterialIndex = renderData ? renderData->MaterialIndex : 0;
+      	objectSSBO[i].TextureIndex = renderData ? renderData->TexImage.DescriptorIndex : DefaultTexImage.DescriptorIndex;
+      	objectSSBO[i].Sphere = renderData ? renderData->Sphere : glm::vec4(0.0f);
       }
-    vkUnmapMemory(Device.LogicalDevice, ObjectBuffers[i].Memory);
   }
 
+  // every buffer is current, indices may have moved
+  DrawsDirty = true;
+  ObjectsByTransform.clear();
+  DirtyObjects.clear();
+  ObjectBounds.Resize((uint32_t)RenderObjectCount);
+
+  for (uint32_t i = 0; i < RenderObjectCount; i++)
   {
-    for (size_t i = 0; i < mesh::MesheCounter; i++)
-    {
-      { // CREATE VERTEX BUFFER
-        RenderMeshes[i].VertexBuffer = init::create_vertex_buffer(Device, CommandPool, mesh::Meshes[i], &Deletion);
-      }
+    RenderObjects[i].DirtyImages = 0;
+    ObjectsByTransform.insert({ RenderObjects[i].TransformId, i });
+    UpdateObjectBounds(i);
+  }
+}
 
-      { // CREATE INDEX BUFFER
-        RenderMeshes[i].IndexBuffer = init::create_index_buffer(Device, CommandPool, mesh::Meshes[i], &Deletion);
-      }
+// object buffers for capacity objects per swapchain image, filled from
+// RenderObjects; the old ones go to the deferred buckets and every image
+// rewrites its object set before it records again
+void
+stRenderer::CreateObjectBuffers(
+  uint32_t capacity)
+{
+  for (uint32_t i = 0; i < ObjectBufferCount; i++)
+  {
+    deferred::buffer(ObjectBuffers[i]);
+    deferred::buffer(IndirectBuffers[i]);
+    deferred::buffer(InstanceBuffers[i]);
+    deferred::buffer(CullBuffers[i]);
+  }
 
-      std::string load_texture = mesh::Meshes[i].TexturePath.empty()
-        ? "./data/models/cube/default.png"
-        : mesh::Meshes[i].TexturePath;
+  ObjectCapacity = capacity;
+  ObjectBufferCount = SwapchainImageCount;
+
+  for (uint32_t i = 0; i < ObjectBufferCount; i++)
+  {
+    // persistently mapped, UpdateObjectBuffer writes moved objects every frame
+    init::create_buffer(Device, ObjectCapacity * sizeof(stPerObjectDataGPU), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ObjectBuffers[i], nullptr);
 
-      stTexture* texture = init::get_texture(load_texture);
+    // written by CompactDraws each frame, commands never outnumber objects
+    init::create_buffer(Device, ObjectCapacity * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, IndirectBuffers[i], nullptr);
 
-      if (texture == nullptr)
-      {
-        RenderMeshes[i].TexImage = init::create_texture(Device, CommandPool, load_texture.c_str(), &Deletion);
+    // the culling pass reads the records and writes instances and counts
+    init::create_buffer(Device, ObjectCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, InstanceBuffers[i], nullptr);
+    init::create_buffer(Device, ObjectCapacity * sizeof(stCullRecordGPU), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, CullBuffers[i], nullptr);
+  }
+
+  WriteObjectBuffers();
+  StaleObjectDescriptors = (1u << SwapchainImageCount) - 1;
+}
+
+void
+stRenderer::DestroyObjectBuffers()
+{
+  for (uint32_t i = 0; i < ObjectBufferCount; i++)
+  {
+    init::destroy_buffer(Device, ObjectBuffers[i]);
+    init::destroy_buffer(Device, IndirectBuffers[i]);
+    init::destroy_buffer(Device, InstanceBuffers[i]);
+    init::destroy_buffer(Device, CullBuffers[i]);
+  }
+  ObjectBufferCount = 0;
+}
+
+// replaces the object buffers with ones filled from RenderObjects, the
+// frames in flight still read the old contents; the capacity doubles
+// until count objects fit, so it belongs to load paths and not to Render
+void
+stRenderer::ReserveObjects(
+  uint64_t count)
+{
+  uint64_t capacity = ObjectCapacity;
+  while (capacity < count)
+  {
+    capacity *= 2;
+  }
 
-        for (size_t i = 0; i < init::TextureCounter; i++)
+  CreateObjectBuffers((uint32_t)capacity);
+}
+
+// streams the transforms changed since this image was last rendered into
+// its object buffer, which stays mapped; the image's fence has been waited
+void
+stRenderer::UpdateObjectBuffer(
+  uint32_t imageIndex)
+{
+  uint32_t allImages = (1u << SwapchainImageCount) - 1;
+
+  if (Transforms)
+  {
+    for (uint64_t id : Transforms->Dirty)
+    {
+      auto range = ObjectsByTransform.equal_range((int64_t)id);
+      for (auto it = range.first; it != range.second; it++)
+      {
+        stRenderObject& object = RenderObjects[it->second];
+        if (object.DirtyImages == 0)
         {
-          for (size_t j = 0; j < SwapchainImageCount; j++)
-          {
-            init::update_descriptor_set(Device, TextureSets[i][j], init::Textures[i]);
-          }
+          DirtyObjects.push_back(it->second);
         }
+        object.DirtyImages = allImages;
+        UpdateObjectBounds((uint32_t)it->second);
       }
-      else
-        RenderMeshes[i].TexImage = *texture;
+    }
+    Transforms->Dirty.clear();
+  }
+
+  if (DirtyObjects.empty())
+  {
+    return;
+  }
+
+  stPerObjectDataGPU* objectSSBO = (stPerObjectDataGPU*)ObjectBuffers[imageIndex].Allocation.Mapped;
+  uint32_t bit = 1u << imageIndex;
+
+  if (DirtyObjects.size() * 2 > RenderObjectCount)
+  {
+    // most objects moved, one sequential pass beats sorting the scattered writes
+    for (uint32_t i = 0; i < RenderObjectCount; i++)
+    {
+      objectSSBO[i].Model = *RenderObjects[i].Transform;
+      RenderObjects[i].DirtyImages &= ~bit;
+    }
+  }
+  else
+  {
+    // ascending writes keep the write combined mapping happy
+    std::sort(DirtyObjects.begin(), DirtyObjects.end());
 
-      RenderMeshesCache.insert({&mesh::Meshes[i], &RenderMeshes[i]});
+    for (uint32_t index : DirtyObjects)
+    {
+      stRenderObject& object = RenderObjects[index];
+      if (object.DirtyImages & bit)
+      {
+        objectSSBO[index].Model = *object.Transform;
+        object.DirtyImages &= ~bit;
+      }
     }
   }
+
+  DirtyObjects.erase(
+    std::remove_if(DirtyObjects.begin(), DirtyObjects.end(),
+      [this](uint32_t index)
+      {
+        return RenderObjects[index].DirtyImages == 0;
+      }),
+    DirtyObjects.end());
+}
+
+// points the slot's element of every bindless set at the texture living
+// there, or at the default texture for a free slot; frames in flight do
+// not sample a slot before its texture is written
+void
+stRenderer::WriteTextureDescriptor(
+  uint32_t textureIndex)
+{
+  stTexture* texture = init::get_texture(textureIndex);
+
+  for (size_t i = 0; i < SwapchainImageCount; i++)
+  {
+    init::update_descriptor_set(Device, TextureSets[i], texture ? *texture : DefaultTexImage, textureIndex);
+  }
 }
 
 void
@@ -525,44 +1175,66 @@ stRenderer::CreateSwapchain()
     };
 
     Framebuffers[i] = init::create_framebuffer(Device, ForwardRenderPass, SwapchainExtent, attachments, 3, &SwapchainDeletion);
+  }
 
-    init::create_buffer(Device, MAX_OBJECTS_COUNT * sizeof(stPerObjectDataGPU), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ObjectBuffers[i], &SwapchainDeletion);
+  if (ObjectBufferCount != SwapchainImageCount)
+  {
+    CreateObjectBuffers(ObjectCapacity);
   }
 
+  // batches compare the pipelines recreated below
+  DrawsDirty = true;
+
   GraphicsPipeline = init::create_gfx_pipeline(Device, SwapchainExtent, ForwardRenderPass, SamplesFlag, &SwapchainDeletion);
 
-  stMaterial* mat = material::create_material(GraphicsPipeline.Pipeline, GraphicsPipeline.Layout, "default");
+  material::create_material(GraphicsPipeline.Pipeline, GraphicsPipeline.Layout, "default");
+
+  // variants for glTF alpha modes and double sided materials, their set
+  // layouts are identical so the descriptor sets stay compatible
+  {
+    stGfxPipeline doubleSided = init::create_gfx_pipeline(Device, SwapchainExtent, ForwardRenderPass, SamplesFlag, &SwapchainDeletion, VK_CULL_MODE_NONE, false);
+    stGfxPipeline blend = init::create_gfx_pipeline(Device, SwapchainExtent, ForwardRenderPass, SamplesFlag, &SwapchainDeletion, VK_CULL_MODE_BACK_BIT, true);
+    stGfxPipeline blendDoubleSided = init::create_gfx_pipeline(Device, SwapchainExtent, ForwardRenderPass, SamplesFlag, &SwapchainDeletion, VK_CULL_MODE_NONE, true);
+
+    material::create_material(doubleSided.Pipeline, doubleSided.Layout, "default_double_sided");
+    material::create_material(blend.Pipeline, blend.Layout, "default_blend");
+    material::create_material(blendDoubleSided.Pipeline, blendDoubleSided.Layout, "default_blend_double_sided");
+  }
 
   VkDescriptorPoolSize poolSizes[] =
   { 
     { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
-    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * SwapchainImageCount }
   };
 
-  DescriptorPool = init::create_descriptor_pools(Device, poolSizes, ArrayCount(poolSizes), (MAX_TEXTURE_COUNT + 1) * SwapchainImageCount * ArrayCount(poolSizes), &SwapchainDeletion);
+  DescriptorPool = init::create_descriptor_pools(Device, poolSizes, ArrayCount(poolSizes), SwapchainImageCount * ArrayCount(poolSizes), &SwapchainDeletion);
 
-  for (size_t tc = 0; tc < MAX_TEXTURE_COUNT; tc++)
+  // the texture pool was flushed with the swapchain, refill every slot
   {
-    VkDescriptorSetLayout layouts[] = { GraphicsPipeline.SamplerLayout, GraphicsPipeline.SamplerLayout, GraphicsPipeline.SamplerLayout };
-    
-    VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-	  allocInfo.descriptorPool = DescriptorPool;
-	  allocInfo.descriptorSetCount = ArrayCount(layouts);
-	  allocInfo.pSetLayouts = layouts;
+    VkDescriptorPoolSize texturePoolSizes[] =
+    {
+      { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_TEXTURES * SwapchainImageCount }
+    };
 
-	  VK_CHECK(vkAllocateDescriptorSets(Device.LogicalDevice, &allocInfo, &TextureSets[tc][0]));
+    TexturePool = init::create_descriptor_pools(Device, texturePoolSizes, ArrayCount(texturePoolSizes), SwapchainImageCount, &SwapchainDeletion, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT);
 
+    VkDescriptorSetLayout layouts[MAX_SWAPCHAIN_IMAGE_COUNT];
     for (size_t i = 0; i < SwapchainImageCount; i++)
     {
-	    VkDescriptorImageInfo imageBufferInfo;
-	    imageBufferInfo.sampler = DefaultTexImage.Sampler;
-	    imageBufferInfo.imageView = DefaultTexImage.Image.View;
-	    imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      layouts[i] = GraphicsPipeline.SamplerLayout;
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    allocInfo.descriptorPool = TexturePool;
+    allocInfo.descriptorSetCount = SwapchainImageCount;
+    allocInfo.pSetLayouts = layouts;
 
-	    VkWriteDescriptorSet texture1 = init::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, TextureSets[tc][i], &imageBufferInfo, 0);
+    VK_CHECK(vkAllocateDescriptorSets(Device.LogicalDevice, &allocInfo, TextureSets));
+  }
 
-	    vkUpdateDescriptorSets(Device.LogicalDevice, 1, &texture1, 0, nullptr);
-    }
+  for (uint32_t i = 0; i < init::Textures.Capacity(); i++)
+  {
+    WriteTextureDescriptor(i);
   }
 
   {
@@ -575,22 +1247,52 @@ stRenderer::CreateSwapchain()
 
 		VK_CHECK(vkAllocateDescriptorSets(Device.LogicalDevice, &objectSetAlloc, &ObjectDescriptors[0]));
 
-    for (size_t i = 0; i < SwapchainImageCount; i++)
+    for (uint32_t i = 0; i < SwapchainImageCount; i++)
     {
-		  VkDescriptorBufferInfo objectBufferInfo;
-		  objectBufferInfo.buffer = ObjectBuffers[i].Buffer;
-		  objectBufferInfo.offset = 0;
-		  objectBufferInfo.range = sizeof(stPerObjectDataGPU) * MAX_OBJECTS_COUNT;
-
-		  VkWriteDescriptorSet objectWrite = init::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, ObjectDescriptors[i], &objectBufferInfo, 0);
-
-		  vkUpdateDescriptorSets(Device.LogicalDevice, 1, &objectWrite, 0, nullptr);
+      WriteObjectDescriptors(i);
     }
+    StaleObjectDescriptors = 0;
   }
 
   init::create_command_buffers(Device, CommandPool, CommandBuffers, SwapchainImageCount, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &SwapchainDeletion);
 }
 
+// points the object set of the image at the current buffers, the image's
+// fence has been waited
+void
+stRenderer::WriteObjectDescriptors(
+  uint32_t imageIndex)
+{
+  VkDescriptorBufferInfo objectBufferInfo;
+  objectBufferInfo.buffer = ObjectBuffers[imageIndex].Buffer;
+  objectBufferInfo.offset = 0;
+  objectBufferInfo.range = sizeof(stPerObjectDataGPU) * ObjectCapacity;
+
+  VkDescriptorBufferInfo materialBufferInfo;
+  materialBufferInfo.buffer = MaterialBuffer.Buffer;
+  materialBufferInfo.offset = 0;
+  materialBufferInfo.range = sizeof(stMaterialDataGPU) * UploadedMaterialCount;
+
+  VkDescriptorBufferInfo instanceBufferInfo;
+  instanceBufferInfo.buffer = InstanceBuffers[imageIndex].Buffer;
+  instanceBufferInfo.offset = 0;
+  instanceBufferInfo.range = sizeof(uint32_t) * ObjectCapacity;
+
+  VkWriteDescriptorSet writes[] =
+  {
+    init::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, ObjectDescriptors[imageIndex], &objectBufferInfo, 0),
+    init::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, ObjectDescriptors[imageIndex], &materialBufferInfo, 1),
+    init::write_descriptor_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, ObjectDescriptors[imageIndex], &instanceBufferInfo, 2)
+  };
+
+  vkUpdateDescriptorSets(Device.LogicalDevice, ArrayCount(writes), writes, 0, nullptr);
+
+  if (GpuCulling)
+  {
+    CullingPass.WriteDescriptors(imageIndex, ObjectBuffers[imageIndex].Buffer, CullBuffers[imageIndex].Buffer, IndirectBuffers[imageIndex].Buffer, InstanceBuffers[imageIndex].Buffer, ObjectCapacity);
+  }
+}
+
 void
 stRenderer::RecreateSwapchain()
 {
@@ -600,23 +1302,28 @@ stRenderer::RecreateSwapchain()
   }
 
   VK_CHECK(vkDeviceWaitIdle(Device.LogicalDevice));
+  deferred::flush();
   SwapchainDeletion.Flush();
 
   CreateSwapchain();
-
-  for (size_t i = 0; i < init::TextureCounter; i++)
-  {
-    for (size_t j = 0; j < SwapchainImageCount; j++)
-    {
-      init::update_descriptor_set(Device, TextureSets[i][j], init::Textures[i]);
-    }
-  }
 }
 
 void
 stRenderer::Term()
 {
+  upload::wait();
   VK_CHECK(vkDeviceWaitIdle(Device.LogicalDevice));
+
+  // whatever is still loaded leaves the way unloaded meshes do
+  for (uint32_t i = 0; i < RenderMeshes.size(); i++)
+  {
+    ReleaseRenderMesh(i);
+  }
+  deferred::buffer(MaterialBuffer);
+
+  deferred::flush();
+  TextureStreamer.Term();
+  DestroyObjectBuffers();
   SwapchainDeletion.Flush();
   Deletion.Flush();
 }
@@ -647,6 +1354,7 @@ void
 stRenderer::Render(double delta)
 {
   vkWaitForFences(Device.LogicalDevice, 1, &InFlightFence[CurrentFrame], VK_TRUE, ~0ull);
+  deferred::begin_frame(CurrentFrame);
 
   uint32_t imageIndex = 0;
   VK_CHECK(vkAcquireNextImageKHR(Device.LogicalDevice, Swapchain, ~0ull, AcquireSemaphores[CurrentFrame], VK_NULL_HANDLE, &imageIndex));
@@ -659,6 +1367,25 @@ stRenderer::Render(double delta)
 
   vkResetFences(Device.LogicalDevice, 1, &InFlightFence[CurrentFrame]);
 
+  ReleaseUnloadedMeshes();
+
+  if (StaleObjectDescriptors & (1u << imageIndex))
+  {
+    WriteObjectDescriptors(imageIndex);
+    StaleObjectDescriptors &= ~(1u << imageIndex);
+  }
+
+  UpdateObjectBuffer(imageIndex);
+
+#if TEXTURE_STREAMING
+  RequestTextureMips();
+  TextureStreamer.Update(SwapchainImageCount);
+  TextureStreamer.UpdateDescriptors(TextureSets, imageIndex);
+#endif
+
+  // everything uploaded since the last frame goes ahead of this frame
+  upload::submit();
+
   VkPipelineStageFlags submitStageFlags[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 
   //
@@ -678,10 +1405,18 @@ stRenderer::Render(double delta)
     // stRenderMeshData* renderData = RenderMeshesCache[RenderObjects[i].Mesh];
     // init::update_descriptor_set(Device, DescriptorSets1[i][imageIndex], init::Textures[i]);
   //}
-  uint32_t descriptorsCount = init::TextureCounter;
 
   VK_CHECK(vkBeginCommandBuffer(CommandBuffers[imageIndex], &beginInfo));
 
+  MorphPass.Record(CommandBuffers[imageIndex]);
+
+  if (Animation)
+  {
+    SkinningPass.Record(CommandBuffers[imageIndex], imageIndex, *Animation);
+  }
+
+  PrepareDraws(CommandBuffers[imageIndex], imageIndex, RenderObjects.data(), RenderObjectCount);
+
   VkClearValue clearValues[2] =
   {
     {{ 0.1f, 0.1f, 0.1f, 1.0f }},
@@ -699,7 +1434,7 @@ stRenderer::Render(double delta)
   vkCmdBeginRenderPass(CommandBuffers[imageIndex], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
   {
-    DrawObjects(CommandBuffers[imageIndex], imageIndex, TextureSets, descriptorsCount, RenderObjects.data(), RenderObjectCount);
+    DrawObjects(CommandBuffers[imageIndex], imageIndex, TextureSets[imageIndex]);
   }
 
   vkCmdEndRenderPass(CommandBuffers[imageIndex]);
@@ -733,57 +1468,281 @@ stRenderer::Render(double delta)
 }
 
 void
-stRenderer::DrawObjects(
+stRenderer::RequestTextureMips()
+{
+  // pixels covered by one world unit at unit distance
+  float projectionScale = SwapchainExtent.height / (2.0f * tanf(glm::radians(Camera->FieldOfView) * 0.5f));
+
+  TextureStreamer.BeginFrame();
+
+  for (size_t i = 0; i < RenderObjectCount; i++)
+  {
+    stRenderObject& object = RenderObjects[i];
+    stRenderMeshData* renderData = GetRenderMesh(object.Mesh);
+    if (!renderData)
+    {
+      continue;
+    }
+
+    const glm::mat4& transform = *object.Transform;
+
+    glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(renderData->Sphere), 1.0f));
+    float scale = glm::max(glm::length(glm::vec3(transform[0])), glm::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    float radius = renderData->Sphere.w * scale;
+    float distance = glm::max(glm::length(center - Camera->Position) - radius, 0.1f);
+
+    TextureStreamer.Request(renderData->TexImage.DescriptorIndex, 2.0f * radius * projectionScale / distance);
+  }
+}
+
+void
+stRenderer::SetMorphWeights(
+  mesh::stMeshHandle mesh,
+  const float* weights,
+  uint32_t count)
+{
+  MorphPass.SetWeights(mesh, weights, count);
+}
+
+void
+stRenderer::UpdateObjectBounds(
+  uint32_t object)
+{
+  stRenderMeshData* renderData = GetRenderMesh(RenderObjects[object].Mesh);
+  ObjectBounds.Set(object, *RenderObjects[object].Transform, renderData ? renderData->Sphere : glm::vec4(0.0f));
+}
+
+void
+stRenderer::CullObjects(
+  const glm::mat4& viewProj)
+{
+  glm::vec4 planes[6];
+  frustum_planes(viewProj, planes);
+
+  uint32_t count = ObjectBounds.Count;
+  ObjectVisible.resize(count);
+
+  // chunks are a multiple of four spheres, each job owns its lanes
+  uint32_t chunkCount = (count + CPU_CULLING_CHUNK - 1) / CPU_CULLING_CHUNK;
+
+  mesh::run_jobs(Jobs, chunkCount, [&](uint32_t chunk)
+  {
+    uint32_t first = chunk * CPU_CULLING_CHUNK;
+    cull_spheres(ObjectBounds, planes, first, glm::min(count - first, (uint32_t)CPU_CULLING_CHUNK), ObjectVisible.data());
+  });
+}
+
+void
+stRenderer::PrepareDraws(
   VkCommandBuffer cmd,
   uint32_t targetIndex,
-  VkDescriptorSet descriptorSets[MAX_TEXTURE_COUNT][MAX_SWAPCHAIN_IMAGE_COUNT],
-  uint32_t descriptorSetCount,
   stRenderObject* first,
   uint32_t count)
 {
-  if (count == 0) return;
+  RenderQueue.Stats = {};
+
+  glm::mat4 viewProj =
+    Camera->get_projection_matrix({ SwapchainExtent.width, SwapchainExtent.height })
+    * Camera->get_view_matrix();
+
+  // objects are indexed from the start of the object buffer
+  uint32_t firstObject = (uint32_t)(first - RenderObjects.data());
+
+#if CULLING_VALIDATE
+  // this image's fence was waited, its culling pass has finished
+  if (GpuCulling && ValidateCommands[targetIndex] > 0)
+  {
+    const VkDrawIndexedIndirectCommand* commands = (const VkDrawIndexedIndirectCommand*)IndirectBuffers[targetIndex].Allocation.Mapped;
+
+    uint32_t visible = 0;
+    for (uint32_t i = 0; i < ValidateCommands[targetIndex]; i++)
+    {
+      visible += commands[i].instanceCount;
+    }
+
+    if (visible != ExpectedVisible[targetIndex])
+    {
+      printf("Culling mismatch on image %u: GPU kept %u objects, CPU %u\n", targetIndex, visible, ExpectedVisible[targetIndex]);
+    }
+  }
+#endif
+
+  // the CPU culler filters the queue when the GPU does not cull, and
+  // predicts the GPU result when validating
+  bool cpuCulling = CPU_CULLING && (!GpuCulling || CULLING_VALIDATE);
+  bool filter = cpuCulling && !GpuCulling;
+
+  if (cpuCulling)
+  {
+    CullObjects(viewProj);
+  }
+
+  const uint8_t* visible = filter ? ObjectVisible.data() : nullptr;
+
+  if (DrawsDirty)
+  {
+    QueueDraws(first, count);
+    DrawsDirty = false;
+    DrawsCompacted = false;
+    StaleDrawImages = (1u << SwapchainImageCount) - 1;
+  }
+
+  // the opaque commands only change with the queue, unless the CPU culler
+  // drops objects from them every frame
+  if (filter || !DrawsCompacted)
+  {
+    IndirectCommands.clear();
+    IndirectBatches.clear();
+    CullRecords.clear();
+
+    CompactDraws(first, firstObject, RenderQueue.Items, visible);
+
+    CachedCommandCount = IndirectCommands.size();
+    CachedBatchCount = IndirectBatches.size();
+    CachedRecordCount = filter ? 0 : CullRecords.size();
+    DrawsCompacted = !filter;
+  }
+  else
+  {
+    IndirectCommands.resize(CachedCommandCount);
+    IndirectBatches.resize(CachedBatchCount);
+    CullRecords.resize(CachedRecordCount);
+  }
+
+  // blended draws go back to front, their order follows the camera
+  if (!BlendQueue.Items.empty())
+  {
+    for (stRenderQueueItem& item : BlendQueue.Items)
+    {
+      float depth = glm::length(glm::vec3((*first[item.Object].Transform)[3]) - Camera->Position);
+      item.Key = DrawKey(first[item.Object], ALPHA_MODE_BLEND, depth);
+    }
+
+    BlendQueue.Sort();
+    CompactDraws(first, firstObject, BlendQueue.Items, visible);
+  }
+
+  if (cpuCulling && GpuCulling)
+  {
+    uint32_t expectedVisible = 0;
+    for (const stCullRecordGPU& record : CullRecords)
+    {
+      expectedVisible += ObjectVisible[record.Object];
+    }
+
+    ExpectedVisible[targetIndex] = expectedVisible;
+  }
+  ValidateCommands[targetIndex] = cpuCulling && GpuCulling ? (uint32_t)IndirectCommands.size() : 0;
+
+  // records up to rewriteFrom are in this image's buffers already
+  uint32_t bit = 1u << targetIndex;
+  size_t rewriteFrom = (StaleDrawImages & bit) ? 0 : CachedRecordCount;
+  StaleDrawImages &= ~bit;
+
+  if (!GpuCulling)
+  {
+    uint32_t* instances = (uint32_t*)InstanceBuffers[targetIndex].Allocation.Mapped;
+    for (size_t i = rewriteFrom; i < CullRecords.size(); i++)
+    {
+      instances[i] = CullRecords[i].Object;
+    }
+  }
+
+  // with GpuCulling this also resets the instance counts the culling pass
+  // appended to last time
+  if (Device.MultiDrawIndirect)
+  {
+    memcpy(IndirectBuffers[targetIndex].Allocation.Mapped, IndirectCommands.data(), IndirectCommands.size() * sizeof(VkDrawIndexedIndirectCommand));
+  }
+
+  if (GpuCulling)
+  {
+    memcpy((stCullRecordGPU*)CullBuffers[targetIndex].Allocation.Mapped + rewriteFrom, CullRecords.data() + rewriteFrom, (CullRecords.size() - rewriteFrom) * sizeof(stCullRecordGPU));
+
+    CullingPass.Record(cmd, targetIndex, viewProj, (uint32_t)CullRecords.size());
+  }
+}
+
+// sort key of the object's draw; opaque and masked draws ignore depth, so
+// their keys stay valid while the camera moves
+uint64_t
+stRenderer::DrawKey(
+  const stRenderObject& object,
+  uint32_t pass,
+  float depth)
+{
+  stRenderMeshData* renderData = GetRenderMesh(object.Mesh);
+
+  uint32_t texture = renderData->TexImage.Src != VK_NULL_HANDLE
+    ? renderData->TexImage.DescriptorIndex
+    : DefaultTexImage.DescriptorIndex;
+
+  return make_draw_key(pass, object.Material.Index, texture, object.Mesh.Index, pass == ALPHA_MODE_BLEND ? depth : 0.0f);
+}
+
+// sorts the drawable objects into RenderQueue, blended ones only go to
+// BlendQueue and are sorted each frame
+void
+stRenderer::QueueDraws(
+  stRenderObject* first,
+  uint32_t count)
+{
+  RenderQueue.Clear();
+  BlendQueue.Clear();
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    stRenderObject& object = first[i];
+    stRenderMeshData* renderData = GetRenderMesh(object.Mesh);
+
+    if (!renderData || !material::Materials.Get(object.Material))
+    {
+      continue;
+    }
+
+    uint32_t pass = MaterialData[renderData->MaterialIndex].AlphaMode;
+    if (pass == ALPHA_MODE_BLEND)
+    {
+      BlendQueue.Push(0, i);
+    }
+    else
+    {
+      RenderQueue.Push(DrawKey(object, pass, 0.0f), i);
+    }
+  }
+
+  RenderQueue.Sort();
+}
+
+void
+stRenderer::DrawObjects(
+  VkCommandBuffer cmd,
+  uint32_t targetIndex,
+  VkDescriptorSet textureSet)
+{
+  if (IndirectBatches.empty()) return;
   
-  auto bindDescriptors =
-  [cmd, descriptorSets, targetIndex](
-    stRenderObject& draw,
-    VkDescriptorSet* objectDescriptors,
-    stRenderMeshData* renderData)
+  // object data, materials and textures are indexed in the shaders, so
+  // both sets are bound once and only pipeline changes cost a bind
+  auto bindSets = [cmd, targetIndex, textureSet](
+    stMaterial* material,
+    VkDescriptorSet* objectDescriptors)
   {
-    //* (*draw.Transform);
+    VkDescriptorSet sets[] = { textureSet, objectDescriptors[targetIndex] };
 
     vkCmdBindDescriptorSets(
       cmd,
       VK_PIPELINE_BIND_POINT_GRAPHICS,
-      draw.Material->PipelineLayout,
+      material->PipelineLayout,
       0,
-      1,
-      &descriptorSets[renderData->TexImage.DescriptorSetIndex][targetIndex],
-      0,
-      nullptr
-    );
-
-    vkCmdBindDescriptorSets(
-      cmd,
-      VK_PIPELINE_BIND_POINT_GRAPHICS,
-      draw.Material->PipelineLayout,
-      1,
-      1,
-      &objectDescriptors[targetIndex],
+      ArrayCount(sets),
+      sets,
       0,
       nullptr);
   };
 
-  auto bindMeshes = [cmd](
-    stRenderMeshData* renderData)
-  {
-    VkBuffer vertexBuffers[] = { renderData->VertexBuffer.Buffer };
-    VkDeviceSize offsets[] = { 0 };
-    vkCmdBindVertexBuffers(cmd, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(cmd, renderData->IndexBuffer.Buffer, 0, VK_INDEX_TYPE_UINT32);
-  };
-
   auto pushConstants = [=](
-    stRenderObject& draw)
+    stMaterial* material)
   {
     stGlobalDataGPU constants = {};
     constants.ViewProj =
@@ -791,43 +1750,153 @@ stRenderer::DrawObjects(
       * Camera->get_view_matrix();
     constants.DirectionalLight = Sun->LightDirection;
     
-    vkCmdPushConstants(cmd, draw.Material->PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(stGlobalDataGPU), &constants);
+    vkCmdPushConstants(cmd, material->PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(stGlobalDataGPU), &constants);
   };
 
-  //std::vector<stIndirectBatch> draws = CompactDraws(first, count);
+  VkBuffer indirectBuffer = IndirectBuffers[targetIndex].Buffer;
+  uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
 
-  //for (stIndirectBatch& draw : draws)
-  //{
-  //  stRenderMeshData* renderData = RenderMeshesCache[draw.Mesh];
+  // pipelines share one layout, so sets and push constants survive
+  // pipeline changes
+  stRenderQueueStats& stats = RenderQueue.Stats;
+
+  VkPipeline boundPipeline = VK_NULL_HANDLE;
+  VkBuffer boundVertices = VK_NULL_HANDLE;
 
-  //  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.Material->Pipeline);
+  for (uint32_t i = 0; i < IndirectBatches.size(); i++)
+  {
+    const stIndirectBatch& batch = IndirectBatches[i];
 
-  //  bindDescriptors(draw, renderData);
+    if (batch.Material->Pipeline != boundPipeline)
+    {
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.Material->Pipeline);
+      stats.PipelineBinds++;
 
-  //  bindMeshes(renderData);
+      if (boundPipeline == VK_NULL_HANDLE)
+      {
+        bindSets(batch.Material, ObjectDescriptors);
+        pushConstants(batch.Material);
+        Geometry.Bind(cmd);
+        boundVertices = Geometry.VertexBuffer.Buffer;
+        stats.SetBinds++;
+        stats.VertexBinds++;
+      }
 
-  //  pushConstants(draw);
+      boundPipeline = batch.Material->Pipeline;
+    }
 
-  //  for(int i = draw.First ;i < draw.Count;i++)
-  //  {
-  //    vkCmdDrawIndexed(cmd, (uint32_t) draw.Mesh->Indices.size(), 1, 0, 0, 0);
-  //  }
-  //}
+    if (batch.Vertices != boundVertices)
+    {
+      VkDeviceSize offset = 0;
+      vkCmdBindVertexBuffers(cmd, 0, 1, &batch.Vertices, &offset);
+      boundVertices = batch.Vertices;
+      stats.VertexBinds++;
+    }
 
+    VkDeviceSize offset = (VkDeviceSize)batch.First * stride;
 
-  for (size_t i = 0; i < count; i++)
+    // commands the culling pass emptied still cost a fetch, the batches
+    // are too short to make compacting them worth a second pass
+    if (Device.MultiDrawIndirect)
+    {
+      vkCmdDrawIndexedIndirect(cmd, indirectBuffer, offset, batch.Count, stride);
+      stats.DrawCalls++;
+    }
+    else
+    {
+      for (uint32_t c = batch.First; c < batch.First + batch.Count; c++)
+      {
+        const VkDrawIndexedIndirectCommand& command = IndirectCommands[c];
+        vkCmdDrawIndexed(cmd, command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+      }
+      stats.DrawCalls += batch.Count;
+    }
+
+    stats.Draws += batch.Objects;
+  }
+
+  // what binding per object would have cost
+  stats.PipelineBindsSkipped = stats.Draws - stats.PipelineBinds;
+  stats.SetBindsSkipped = stats.Draws - stats.SetBinds;
+  stats.VertexBindsSkipped = stats.Draws - stats.VertexBinds;
+}
+
+// appends the sorted items to the indirect commands, one per run of
+// objects drawing the same mesh, batched while pipeline and vertex buffer
+// stay the same; the first item starts a new batch. CullRecords lists the
+// objects in instance order. Items whose visible entry is 0 are skipped.
+void
+stRenderer::CompactDraws(
+  stRenderObject* first,
+  uint32_t firstObject,
+  const std::vector<stRenderQueueItem>& items,
+  const uint8_t* visible)
+{
+  const stRenderMeshData* lastMesh = nullptr;
+  size_t firstBatch = IndirectBatches.size();
+
+  for (const stRenderQueueItem& item : items)
   {
-    stRenderObject& object = first[i];
-    stRenderMeshData* renderData = RenderMeshesCache[object.Mesh];
+    if (visible && !visible[firstObject + item.Object])
+    {
+      RenderQueue.Stats.Culled++;
+      continue;
+    }
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.Material->Pipeline);
-    
-    bindDescriptors(object, ObjectDescriptors, renderData);
-    
-    bindMeshes(renderData);
-    
-    pushConstants(object);    
+    const stRenderObject& object = first[item.Object];
+    stRenderMeshData* renderData = GetRenderMesh(object.Mesh);
+    stMaterial* material = material::Materials.Get(object.Material);
+
+    bool deformed = renderData->DeformedVertices.Buffer != VK_NULL_HANDLE;
+    VkBuffer vertices = deformed ? renderData->DeformedVertices.Buffer : Geometry.VertexBuffer.Buffer;
+
+    if (IndirectBatches.size() == firstBatch
+      || IndirectBatches.back().Material->Pipeline != material->Pipeline
+      || IndirectBatches.back().Vertices != vertices)
+    {
+      stIndirectBatch batch = {};
+      batch.Material = material;
+      batch.Vertices = vertices;
+      batch.First = (uint32_t)IndirectCommands.size();
+      IndirectBatches.push_back(batch);
+      lastMesh = nullptr;
+    }
+
+    stIndirectBatch& batch = IndirectBatches.back();
+    batch.Objects++;
+
+    // culled instances land in any order, blended objects keep a command
+    // each to stay sorted back to front
+    bool blend = (item.Key >> (64 - DRAW_KEY_PASS_BITS)) == ALPHA_MODE_BLEND;
+
+    if (renderData == lastMesh && !blend)
+    {
+      // with GpuCulling the culling pass appends the visible instances
+      if (!GpuCulling)
+      {
+        IndirectCommands.back().instanceCount++;
+      }
+    }
+    else
+    {
+      const stGeometryRange& geometry = renderData->Geometry;
+
+      VkDrawIndexedIndirectCommand command = {};
+      command.indexCount = geometry.IndexCount;
+      command.instanceCount = GpuCulling ? 0 : 1;
+      command.firstIndex = geometry.FirstIndex;
+      command.vertexOffset = deformed ? 0 : geometry.VertexOffset;
+      command.firstInstance = (uint32_t)CullRecords.size();
+
+      IndirectCommands.push_back(command);
+      batch.Count++;
+    }
+
+    stCullRecordGPU record = {};
+    record.Object = firstObject + item.Object;
+    record.Command = (uint32_t)IndirectCommands.size() - 1;
+    CullRecords.push_back(record);
 
-    vkCmdDrawIndexed(cmd, (uint32_t) object.Mesh->Indices.size(), 1, 0, 0, 0);
+    lastMesh = renderData;
   }
 }
\ No newline at end of file
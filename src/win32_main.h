@@ -13,6 +13,16 @@ stWindow
   bool Focused = false;
 };
 
+// read only view of a whole file
+struct
+stMappedFile
+{
+  const uint8_t* Data = nullptr;
+  size_t Size = 0;
+  void* File = nullptr;
+  void* Mapping = nullptr;
+};
+
 // ############################################################################
 // # sys
 // ############################################################################
@@ -48,6 +58,17 @@ GetMessages();
 void
 UpdateInput();
 
+bool
+MapFile(
+  const char* path,
+  stMappedFile* file
+);
+
+void
+UnmapFile(
+  stMappedFile* file
+);
+
 }
 
 // ############################################################################
@@ -277,6 +298,58 @@ sys::UpdateInput()
   g_Engine.Input.KeysPrevHold = g_Engine.Input.KeysHold;
 }
 
+bool
+sys::MapFile(
+  const char* path,
+  stMappedFile* file
+)
+{
+  HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (handle == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER size = {};
+  if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(handle);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+  {
+    CloseHandle(handle);
+    return false;
+  }
+
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!view)
+  {
+    CloseHandle(mapping);
+    CloseHandle(handle);
+    return false;
+  }
+
+  file->Data = (const uint8_t*)view;
+  file->Size = (size_t)size.QuadPart;
+  file->File = handle;
+  file->Mapping = mapping;
+  return true;
+}
+
+void
+sys::UnmapFile(
+  stMappedFile* file
+)
+{
+  if (file->Data) UnmapViewOfFile(file->Data);
+  if (file->Mapping) CloseHandle((HANDLE)file->Mapping);
+  if (file->File) CloseHandle((HANDLE)file->File);
+  *file = {};
+}
+
 VkSurfaceKHR
 CreateSurface(
   VkInstance instance,